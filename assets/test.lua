@@ -2,15 +2,24 @@
 if not initialized then 
     print("Lua script loaded.")
 
-    -- load texture
-    if not LoadTexture("momo", "assets/momo.png") then
-        print("Failed to load momo.png")
+    -- load texture; it decodes in the background, so whether that worked is checked in Update()
+    momoTexture = LoadTexture("momo", "assets/momo.png")
+    if not momoTexture then
+        print("Failed to load momo.png: no graphics")
     end
 
     initialized = true;
 end
 
-function Update()
+function Update(entity)
+    -- report the texture once its decode is over
+    if momoTexture and TextureState(momoTexture) ~= "loading" then
+        if TextureState(momoTexture) == "failed" then
+            print("Failed to load momo.png")
+        end
+        momoTexture = nil
+    end
+
     -- sprite movement
     local speed = 0.05
     local pos = GetPosition(entity)
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "spdlog/spdlog.h"
+
+#include "SpriteGrid.h"
+
+//scrolls a camera across worlds of growing size at the same sprite density and times gathering the visible sprites:
+//testing every sprite against the view (what Draw did before culling) vs walking the SpriteGrid cells under the view
+
+namespace {
+    double Seconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    struct Sprite {
+        float x, y;
+    };
+
+    const float Density = 4.0f;        //sprites per square world unit
+    const float ViewHalfSize = 1.25f;  //half of what a zoom 1 camera sees, plus the largest sprite
+    const float MoveSpeed = 0.05f;     //camera units per frame
+
+    void Run(int count, int frames) {
+        float side = std::sqrt(count / Density);
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> coordinate(0.0f, side);
+
+        std::vector<Sprite> sprites(count);
+        momoengine::SpriteGrid grid;
+        for (int i = 0; i < count; ++i) {
+            sprites[i] = { coordinate(random), coordinate(random) };
+            grid.Insert(i, sprites[i].x, sprites[i].y);
+        }
+
+        //camera path: diagonally across the world, wrapping around
+        auto cameraAt = [&](int frame) {
+            float t = std::fmod(frame * MoveSpeed, side);
+            return Sprite{ t, std::fmod(t * 0.5f + side * 0.25f, side) };
+        };
+
+        std::vector<std::uint32_t> visible;
+        visible.reserve(count);
+
+        std::size_t bruteVisible = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; ++frame) {
+            Sprite camera = cameraAt(frame);
+            visible.clear();
+            for (int i = 0; i < count; ++i) {
+                if (std::abs(sprites[i].x - camera.x) <= ViewHalfSize && std::abs(sprites[i].y - camera.y) <= ViewHalfSize) visible.push_back(i);
+            }
+            bruteVisible += visible.size();
+        }
+        double brute = Seconds(start) / frames;
+
+        //one in a hundred sprites moves every frame; keeping the grid up to date is timed on its own,
+        //since it follows how much moves rather than how much is visible
+        std::uniform_real_distribution<float> step(-0.1f, 0.1f);
+        std::size_t gridVisible = 0;
+        double moving = 0.0, culled = 0.0;
+        for (int frame = 0; frame < frames; ++frame) {
+            start = std::chrono::steady_clock::now();
+            for (int i = frame % 100; i < count; i += 100) {
+                sprites[i].x += step(random);
+                sprites[i].y += step(random);
+                grid.Move(i, sprites[i].x, sprites[i].y);
+            }
+            moving += Seconds(start);
+
+            start = std::chrono::steady_clock::now();
+            Sprite camera = cameraAt(frame);
+            visible.clear();
+            grid.ForEachInRange(grid.RangeOf(camera.x - ViewHalfSize, camera.y - ViewHalfSize, camera.x + ViewHalfSize, camera.y + ViewHalfSize),
+                [&](std::uint32_t i) { visible.push_back(i); });
+            gridVisible += visible.size();
+            culled += Seconds(start);
+        }
+
+        std::cout << count << " sprites (" << (int)side << "x" << (int)side << " world): test every sprite " << brute * 1000.0
+            << " ms/frame (" << bruteVisible / frames << " visible), grid " << culled / frames * 1000.0 << " ms/frame ("
+            << gridVisible / frames << " gathered), moving 1% of sprites in the grid " << moving / frames * 1000.0 << " ms/frame\n";
+    }
+}
+
+int main() {
+    spdlog::set_level(spdlog::level::warn);
+
+    for (int count : { 10000, 100000, 1000000 }) {
+        Run(count, 300);
+    }
+    return 0;
+}
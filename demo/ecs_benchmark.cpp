@@ -0,0 +1,193 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+#include <typeindex>
+#include "spdlog/spdlog.h"
+
+#include "EntityManager.h"
+#include "Types.h"
+
+//compares EntityManager's archetype storage against the old map-of-maps storage,
+//times bulk spawning, checks that spawn/despawn churn stops allocating, then measures how ParallelForEach scales with thread count
+
+namespace {
+    //the previous EntityManager storage: type -> (entity -> heap allocated component)
+    class MapOfMapsEntityManager {
+    public:
+        using Entity = int;
+
+        ~MapOfMapsEntityManager() {
+            for (auto& [type, table] : components) {
+                for (auto& [entity, component] : table) deleters[type](component);
+            }
+        }
+
+        Entity CreateEntity() { return nextEntityID++; }
+
+        template <typename T>
+        void AddComponent(Entity id, const T& c) {
+            components[typeid(T)][id] = new T(c);
+            deleters[typeid(T)] = [](void* p) { delete static_cast<T*>(p); };
+        }
+
+        template <typename T>
+        T& GetComponent(Entity id) { return *static_cast<T*>(components[typeid(T)][id]); }
+
+        template <typename... Components, typename Func>
+        void ForEach(Func func) {
+            auto& firstTable = components[typeid(std::tuple_element_t<0, std::tuple<Components...>>)];
+            for (auto& [entity, firstComponentPtr] : firstTable) {
+                bool hasAll = true;
+                ((hasAll = hasAll && components[typeid(Components)].count(entity) > 0), ...);
+                if (hasAll) func(entity, GetComponent<Components>(entity)...);
+            }
+        }
+
+    private:
+        int nextEntityID = 0;
+        std::unordered_map<std::type_index, std::unordered_map<Entity, void*>> components;
+        std::unordered_map<std::type_index, void(*)(void*)> deleters;
+    };
+
+    double Seconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //creates `count` movers, with a few extra component mixes so there is more than one archetype
+    template <typename Manager>
+    double Populate(Manager& manager, int count) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; ++i) {
+            auto id = manager.CreateEntity();
+            manager.AddComponent(id, Position{ (float)i, 0.0f });
+            manager.AddComponent(id, Velocity{ 1.0f, 0.5f });
+            if (i % 3 == 0) manager.AddComponent(id, Health{});
+            if (i % 5 == 0) manager.AddComponent(id, Gravity{});
+        }
+        return Seconds(start);
+    }
+
+    //integrates position by velocity `frames` times and returns the average time per frame
+    template <typename Manager>
+    double Integrate(Manager& manager, int frames) {
+        const float dt = 1.0f / 60.0f;
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; ++frame) {
+            manager.template ForEach<Position, Velocity>([&](auto, Position& pos, Velocity& vel) {
+                pos.x += vel.x * dt;
+                pos.y += vel.y * dt;
+            });
+        }
+        return Seconds(start) / frames;
+    }
+
+    template <typename Manager>
+    void Run(const char* label, int count, int frames) {
+        Manager manager;
+        double create = Populate(manager, count);
+        double frame = Integrate(manager, frames);
+        std::cout << label << " " << count << " entities: create " << create * 1000.0 << " ms, ForEach "
+            << frame * 1000.0 << " ms/frame\n";
+    }
+
+    //spawning a wave one entity at a time vs one Instantiate() call
+    void SpawnWave(int wave) {
+        EntityManager single;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < wave; ++i) {
+            EntityManager::Entity id = single.CreateEntity();
+            single.AddComponent(id, Position{});
+            single.AddComponent(id, Velocity{ 1.0f, 0.0f });
+            single.AddComponent(id, Health{});
+        }
+        double perEntity = Seconds(start);
+
+        EntityManager bulk;
+        Prefab prefab;
+        prefab.Add(Position{}).Add(Velocity{ 1.0f, 0.0f }).Add(Health{});
+        start = std::chrono::steady_clock::now();
+        bulk.Instantiate(prefab, wave);
+        double instantiate = Seconds(start);
+
+        std::cout << "spawn " << wave << " entities: CreateEntity+AddComponent " << perEntity * 1000.0
+            << " ms, Instantiate " << instantiate * 1000.0 << " ms\n";
+    }
+
+    //spawns and destroys a wave of entities every frame; after warm-up no chunk should come from the heap
+    void SteadyStateChurn(int wave, int frames) {
+        EntityManager manager;
+        std::vector<EntityManager::Entity> live;
+
+        auto frame = [&]() {
+            for (EntityManager::Entity id : live) manager.DestroyEntity(id);
+            live.clear();
+            for (int i = 0; i < wave; ++i) {
+                EntityManager::Entity id = manager.CreateEntity();
+                manager.EmplaceComponent<Position>(id, (float)i, 0.0f);
+                manager.EmplaceComponent<Velocity>(id, 1.0f, 0.0f);
+                manager.AddComponent(id, Script{ "wave" });
+                live.push_back(id);
+            }
+            manager.AdvanceFrame();
+        };
+
+        frame();    //warm-up
+        std::size_t before = manager.GetAllocationStats().heapAllocations;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; ++i) frame();
+        double elapsed = Seconds(start) / frames;
+
+        const auto& stats = manager.GetAllocationStats();
+        std::cout << "churn " << wave << " entities/frame: " << elapsed * 1000.0 << " ms/frame, "
+            << stats.heapAllocations - before << " chunk heap allocations after warm-up, "
+            << stats.reuses << " chunk reuses\n";
+    }
+
+    //Position/Velocity integration on 1, 2, 4, ... threads
+    void ParallelScaling(int count, int frames) {
+        EntityManager manager;
+        Populate(manager, count);
+
+        unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<unsigned> threadCounts;
+        for (unsigned threads = 1; threads < hardware; threads *= 2) threadCounts.push_back(threads);
+        threadCounts.push_back(hardware);
+
+        double singleThreaded = 0.0;
+        for (unsigned threads : threadCounts) {
+            momoengine::JobSystem jobs;
+            jobs.Startup(threads - 1);
+            manager.SetJobSystem(&jobs);
+
+            const float dt = 1.0f / 60.0f;
+            auto start = std::chrono::steady_clock::now();
+            for (int frame = 0; frame < frames; ++frame) {
+                manager.ParallelForEach<Position, const Velocity>([dt](auto, Position& pos, const Velocity& vel) {
+                    pos.x += vel.x * dt;
+                    pos.y += vel.y * dt;
+                });
+            }
+            double frame = Seconds(start) / frames;
+            if (threads == 1) singleThreaded = frame;
+
+            manager.SetJobSystem(nullptr);
+            std::cout << "ParallelForEach " << count << " entities, " << threads << " threads: "
+                << frame * 1000.0 << " ms/frame (" << singleThreaded / frame << "x)\n";
+        }
+    }
+}
+
+int main() {
+    spdlog::set_level(spdlog::level::warn);
+
+    for (int count : { 1000, 10000, 100000 }) {
+        Run<MapOfMapsEntityManager>("map-of-maps", count, 100);
+        Run<EntityManager>("archetype  ", count, 100);
+    }
+
+    SpawnWave(10000);
+    SteadyStateChurn(10000, 100);
+    ParallelScaling(500000, 100);
+    return 0;
+}
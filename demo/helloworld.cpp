@@ -1,4 +1,5 @@
 #include <iostream>
+#include <string>
 #include "spdlog/spdlog.h"
 #include <GLFW/glfw3.h>
 
@@ -21,7 +22,10 @@ void MyUpdateFunction() {
     }
 }
 
-int main() {
+int main(int argc, const char* argv[]) {
+    //--threaded: simulate on a thread of its own and render on this one
+    bool threaded = argc > 1 && std::string(argv[1]) == "--threaded";
+
     Engine engine;
     engine.Startup();
 
@@ -30,6 +34,7 @@ int main() {
 
     //run and load test script
     scripts.LoadScript("test", "assets/test.lua");
+    scripts.LogLoadTimings();
     //auto& lua = scripts.GetLua();
 
     //load a texture at startup
@@ -54,46 +59,26 @@ int main() {
     em.AddComponent(momoEntity, momoPos);
     em.AddComponent(momoEntity, momoScript);
 
-    engine.RunGameLoop( [&]() {
-        /*sol::function updateFunc = lua["Update"];
-        if (updateFunc.valid()) { 
-            sol::protected_function_result result = updateFunc(); 
-
-            if (!result.valid()) {
-                sol::error err = result;
-                spdlog::error("Lua Update() error: {}", err.what());
-            }
-        }*/
-
-        //auto& input = engine.GetInput();
-
-        //if (input.KeyIsPressed(GLFW_KEY_SPACE)) {   //when spacebar is pressed
-            //spdlog::info("Space is pressed!");
-        //}
-
-        //if (input.KeyIsPressed(GLFW_KEY_ESCAPE)) {  //when escape is pressed
-            //spdlog::info("Escape pressed -- quitting engine...");
-            //glfwSetWindowShouldClose(engine.GetGraphics().GetWindow(), true);
-        //}
-        
-        //read the sprites table from Lua
-        /*sol::table luaSprites = lua["sprites"];
-        std::vector<Sprite> spritesToDraw;
-        if (luaSprites.valid()) {
-            for (auto& kv : luaSprites) {
-                sol::object value = kv.second;
-                if (value.is<Sprite>()) {
-                    Sprite s = value.as<Sprite>();
-                    spritesToDraw.push_back(s);
-                }
-            }
-        }*/
+    //systems run once per tick; ones that don't share written components may run at the same time
+    //both of these stay on the main thread: the Lua state and WebGPU aren't thread-safe
+    //scripts run alone, since components they add or remove are applied at the end of Update()
+    engine.AddSystem("scripts", [&](EntityManager& entities) {
         //run Lua scripts attached to entities
-        scripts.Update(em);
+        scripts.Update(entities);
+    }).Reads<Script>().Writes<Position>().Exclusive();
 
-        //draw sprites every frame
-        engine.GetGraphics().Draw(em);
-    });
+    if (threaded) {
+        //the threaded loop draws the published snapshots itself
+        engine.RunThreadedGameLoop();
+    }
+    else {
+        engine.AddSystem("draw", [&](EntityManager& entities) {
+            //draw sprites every frame
+            engine.GetGraphics().Draw(entities);
+        }).Reads<Sprite, Position, Camera>().OnMainThread();
+
+        engine.RunGameLoop();
+    }
 
     //testing RemoveComponent()
     spdlog::info("Testing RemoveComponent for Sprite...");
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include "spdlog/spdlog.h"
+
+#include "GraphicsManager.h"
+#include "EntityManager.h"
+#include "Sprite.h"
+#include "Types.h"
+
+//times GraphicsManager::Draw in headless mode, so it runs on build machines with no display or GPU
+//usage: render_benchmark [--null] [--save frame.png]
+//  --null   Dawn's null backend: measures the CPU side only
+//  --save   writes the last frame of the largest run as a PNG, e.g. to compare against a golden image
+
+using namespace momoengine;
+
+namespace {
+    double Seconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //grows the world to `count` sprites laid out in a square that fits on screen; they drift a little every frame
+    //one EntityManager for every run, since GraphicsManager tracks its changes from one Draw to the next
+    void Run(GraphicsManager& graphics, EntityManager& em, EntityManager::Entity camera, int count, int frames) {
+        int existing = (int)em.GetView<const Sprite, const Position>().Size();
+        for (int i = existing; i < count; ++i) {
+            EntityManager::Entity e = em.CreateEntity();
+            em.AddComponent(e, Position{});
+            em.AddComponent(e, Sprite("momo", glm::vec3(0.0f), glm::vec2(1.0f), (float)(i % 7)));
+        }
+
+        int side = (int)std::ceil(std::sqrt((double)count));
+        int i = 0;
+        em.ForEach<const Sprite, Position>([&](EntityManager::Entity, const Sprite&, Position& pos) {
+            pos = Position{ (float)(i % side), (float)(i / side) };
+            ++i;
+        });
+        em.GetComponent<Camera>(camera) = Camera{ side * 0.5f, side * 0.5f, 2.0f / side };
+
+        graphics.Draw(em);  //warm-up: uploads and sorts everything once
+
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; ++frame) {
+            float dx = (frame % 2 ? 0.01f : -0.01f);
+            em.ForEach<Position>([&](EntityManager::Entity, Position& pos) { pos.x += dx; });
+            graphics.Draw(em);
+            em.AdvanceFrame();
+        }
+        std::vector<unsigned char> pixels;
+        graphics.ReadFrame(pixels);     //waits for the GPU to finish the frames
+        double frame = Seconds(start) / frames;
+
+        const GraphicsManager::FrameStats& stats = graphics.GetFrameStats();
+        std::cout << count << " sprites: " << frame * 1000.0 << " ms/frame, " << stats.drawCalls << " draw calls, "
+            << stats.batches << " batches, " << stats.buffersCreated << " buffers created, "
+            << stats.cpuAllocations << " CPU allocations in the last frame\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    spdlog::set_level(spdlog::level::warn);
+
+    GraphicsManager::HeadlessBackend backend = GraphicsManager::HeadlessBackend::Software;
+    std::string savePath;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--null") backend = GraphicsManager::HeadlessBackend::Null;
+        else if (arg == "--save" && i + 1 < argc) savePath = argv[++i];
+    }
+
+    GraphicsManager graphics;
+    if (!graphics.StartupHeadless(1280, 720, backend)) {
+        std::cerr << "No WebGPU adapter for headless rendering.\n";
+        return 1;
+    }
+    graphics.LoadTexture("momo", "assets/momo.png");    //sprites draw the placeholder if it's missing
+
+    EntityManager em;
+    EntityManager::Entity camera = em.CreateEntity();
+    em.AddComponent(camera, Camera{});
+
+    for (int count : { 1000, 10000, 100000 }) {
+        Run(graphics, em, camera, count, 100);
+    }
+
+    bool saved = savePath.empty() || graphics.SaveFrame(savePath);
+    graphics.Shutdown();
+    return saved ? 0 : 1;
+}
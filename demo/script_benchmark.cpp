@@ -0,0 +1,223 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "spdlog/spdlog.h"
+
+#include "Engine.h"
+#include "EntityManager.h"
+#include "Types.h"
+
+//moves every scripted entity a little each tick, the way test.lua moves its sprite: once through Update(entity)
+//with GetPosition/SetPosition (one Lua call and two EntityManager lookups per entity), once through UpdateAll
+//over chunk arrays and, built with MOMO_LUAJIT, once through UpdateAll writing the chunk memory with FFI
+//UpdateAll runs twice: positions:x/y/set still cross into C++ for every element (only the Update call and the
+//lookups are saved), positions:read/write cross once per batch and leave the loop to plain Lua tables
+//build with and without MOMO_LUAJIT to compare the two VMs
+//then loads a few hundred generated scripts from source, from their .luac caches and from one pack
+//and last, entities that only act once a second: counting down in Update() vs waiting in a Run() coroutine
+
+using namespace momoengine;
+
+namespace {
+    double Seconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    const char* PerEntityScript = R"(
+        function Update(entity)
+            local pos = GetPosition(entity)
+            SetPosition(entity, pos.x + 0.01, pos.y)
+        end
+    )";
+
+    const char* BatchedScript = R"(
+        function UpdateAll(entities, positions)
+            for i = 1, #positions do
+                positions:set(i, positions:x(i) + 0.01, positions:y(i))
+            end
+        end
+    )";
+
+    const char* ColumnScript = R"(
+        function UpdateAll(entities, positions)
+            local xs, ys = positions:read()
+            for i = 1, #xs do
+                xs[i] = xs[i] + 0.01
+            end
+            positions:write(xs, ys)
+        end
+    )";
+
+#ifdef MOMO_LUAJIT
+    const char* FFIScript = R"(
+        function UpdateAll(entities, positions)
+            local p = ffi.cast("Position*", positions:pointer())
+            for i = 0, #positions - 1 do
+                p[i].x = p[i].x + 0.01
+            end
+        end
+    )";
+
+    const char* VM = LUAJIT_VERSION;
+#else
+    const char* VM = LUA_RELEASE;
+#endif
+
+    const char* PollingScript = R"(
+        local countdown = {}
+        function Update(entity)
+            local left = (countdown[entity] or 60) - 1
+            if left == 0 then
+                local pos = GetPosition(entity)
+                SetPosition(entity, pos.x + 0.01, pos.y)
+                left = 60
+            end
+            countdown[entity] = left
+        end
+    )";
+
+    const char* CoroutineScript = R"(
+        function Run(entity)
+            while true do
+                WaitTicks(60)
+                local pos = GetPosition(entity)
+                SetPosition(entity, pos.x + 0.01, pos.y)
+            end
+        end
+    )";
+
+    std::string WriteScript(const std::string& name, const char* source) {
+        std::filesystem::path path = std::filesystem::temp_directory_path() / (name + ".lua");
+        std::ofstream(path) << source;
+        return path.string();
+    }
+
+    //seconds per tick
+    double Run(const char* source, int count, int ticks, bool check = true) {
+        Engine engine;  //never started; scripts only need its EntityManager
+        EntityManager& entities = engine.GetEntityManager();
+        ScriptManager scripts;
+        scripts.Startup(&engine, &engine.GetInput(), nullptr);
+        scripts.LoadScript("mover", WriteScript("momo_script_benchmark", source));
+
+        for (int i = 0; i < count; ++i) {
+            EntityManager::Entity e = entities.CreateEntity();
+            entities.AddComponent(e, Position{ 0.0f, (float)i });
+            entities.AddComponent(e, Script{ "mover" });
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int tick = 0; tick < ticks; ++tick) {
+            scripts.Update(entities);
+            entities.AdvanceFrame();
+        }
+        double seconds = Seconds(start) / ticks;
+
+        //both versions must have moved every entity the same distance
+        float expected = 0.01f * ticks;
+        entities.ForEach<const Position>([&](EntityManager::Entity, const Position& pos) {
+            if (check && std::abs(pos.x - expected) > 0.001f) spdlog::error("Entity moved {} instead of {}", pos.x, expected);
+        });
+
+        scripts.Shutdown();
+        return seconds;
+    }
+
+    //a script about the size of a game's AI or UI logic
+    std::string GeneratedScript(int index) {
+        std::string source = "local state = { count = " + std::to_string(index) + " }\n";
+        for (int f = 0; f < 40; ++f) {
+            source += "local function step" + std::to_string(f) + "(entity, a, b)\n"
+                "    local total = 0\n"
+                "    for i = 1, a do\n"
+                "        if i % 3 == 0 then total = total + i * b elseif i % 5 == 0 then total = total - b else total = total + 1 end\n"
+                "    end\n"
+                "    state.count = state.count + total\n"
+                "    return total\n"
+                "end\n";
+        }
+        source += "function Update(entity) step0(entity, 4, 2) end\n";
+        return source;
+    }
+
+    //loads every script into a fresh ScriptManager and reports what loading them took
+    void Load(const char* label, const std::vector<std::pair<std::string, std::string>>& namesAndPaths, bool cache, const std::string& pack = "") {
+        Engine engine;
+        ScriptManager scripts;
+        scripts.Startup(&engine, &engine.GetInput(), nullptr);
+        scripts.SetBytecodeCache(cache);
+
+        auto start = std::chrono::steady_clock::now();
+        if (pack.empty()) {
+            for (const auto& [name, path] : namesAndPaths) scripts.LoadScript(name, path);
+        }
+        else {
+            scripts.LoadScriptPack(pack);
+        }
+        double seconds = Seconds(start);
+
+        const ScriptManager::LoadTimings& timings = scripts.GetLoadTimings();
+        std::cout << "  " << label << ": " << seconds * 1000.0 << " ms in all, " << timings.compiled << " compiled in "
+            << timings.compileMilliseconds << " ms, " << timings.cached << " from bytecode in " << timings.cachedMilliseconds << " ms\n";
+        scripts.Shutdown();
+    }
+}
+
+int main() {
+    spdlog::set_level(spdlog::level::warn);
+
+    std::cout << VM << "\n";
+    for (int count : { 1000, 5000, 20000 }) {
+        double single = Run(PerEntityScript, count, 100);
+        double batched = Run(BatchedScript, count, 100);
+        double columns = Run(ColumnScript, count, 100);
+        std::cout << count << " scripted entities: Update(entity) " << single * 1000.0 << " ms/tick, UpdateAll with x/y/set "
+            << batched * 1000.0 << " ms/tick (" << single / batched << "x), UpdateAll with read/write "
+            << columns * 1000.0 << " ms/tick (" << single / columns << "x)";
+#ifdef MOMO_LUAJIT
+        double ffi = Run(FFIScript, count, 100);
+        std::cout << ", UpdateAll with FFI " << ffi * 1000.0 << " ms/tick (" << single / ffi << "x)";
+#endif
+        std::cout << "\n";
+    }
+
+    const int scriptCount = 300;
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "momo_script_benchmark";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::vector<std::pair<std::string, std::string>> namesAndPaths;
+    for (int i = 0; i < scriptCount; ++i) {
+        std::string name = "generated" + std::to_string(i);
+        std::filesystem::path path = directory / (name + ".lua");
+        std::ofstream(path) << GeneratedScript(i);
+        namesAndPaths.emplace_back(name, path.string());
+    }
+
+    std::cout << "Loading " << scriptCount << " scripts:\n";
+    Load("without the cache", namesAndPaths, false);
+    Load("first launch, writing .luac files", namesAndPaths, true);
+    Load("from .luac files", namesAndPaths, true);
+    {
+        Engine engine;
+        ScriptManager packer;
+        packer.Startup(&engine, &engine.GetInput(), nullptr);
+        packer.PackScripts((directory / "scripts.pack").string(), namesAndPaths);
+        packer.Shutdown();
+    }
+    Load("from one pack", namesAndPaths, true, (directory / "scripts.pack").string());
+
+    std::filesystem::remove_all(directory);
+
+    for (int count : { 1000, 10000 }) {
+        double polling = Run(PollingScript, count, 600, false);
+        double waiting = Run(CoroutineScript, count, 600, false);
+        std::cout << count << " entities acting once a second: Update() countdown " << polling * 1000.0
+            << " ms/tick, Run() with WaitTicks " << waiting * 1000.0 << " ms/tick\n";
+    }
+    return 0;
+}
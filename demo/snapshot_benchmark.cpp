@@ -0,0 +1,91 @@
+#define SOL_ALL_SAFETIES_ON 1
+#include <sol/sol.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <filesystem>
+#include "spdlog/spdlog.h"
+
+#include "EntityManager.h"
+#include "Snapshot.h"
+#include "Sprite.h"
+#include "Types.h"
+
+//builds the same level three ways: a Lua script calling CreateEntity/Add* bindings one entity at a time,
+//the same calls made from C++, and LoadSnapshot() on a snapshot of the result
+
+namespace {
+    double Seconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //every entity moves and has a sprite; one in ten runs a script
+    void BuildLevel(EntityManager& em, int count) {
+        for (int i = 0; i < count; ++i) {
+            EntityManager::Entity e = em.CreateEntity();
+            float x = (float)(i % 1000);
+            float y = (float)(i / 1000);
+            em.AddComponent(e, Position{ x, y });
+            em.AddComponent(e, Velocity{ 1.0f, 0.0f });
+            em.AddComponent(e, momoengine::Sprite("momo", glm::vec3(x, y, 0.0f)));
+            if (i % 10 == 0) em.AddComponent(e, Script{ "test" });
+        }
+    }
+
+    double BuildFromLua(EntityManager& em, int count) {
+        sol::state lua;
+        lua.open_libraries(sol::lib::base, sol::lib::math);
+        lua.set_function("CreateEntity", [&]() { return em.CreateEntity(); });
+        lua.set_function("AddPosition", [&](EntityManager::Entity e, float x, float y) { em.AddComponent(e, Position{ x, y }); });
+        lua.set_function("AddVelocity", [&](EntityManager::Entity e, float x, float y) { em.AddComponent(e, Velocity{ x, y }); });
+        lua.set_function("AddSprite", [&](EntityManager::Entity e, const std::string& name, float x, float y) {
+            em.AddComponent(e, momoengine::Sprite(name, glm::vec3(x, y, 0.0f)));
+        });
+        lua.set_function("AddScript", [&](EntityManager::Entity e, const std::string& name) { em.AddComponent(e, Script{ name }); });
+        lua["count"] = count;
+
+        auto start = std::chrono::steady_clock::now();
+        lua.script(R"(
+            for i = 0, count - 1 do
+                local e = CreateEntity()
+                local x, y = i % 1000, math.floor(i / 1000)
+                AddPosition(e, x, y)
+                AddVelocity(e, 1, 0)
+                AddSprite(e, "momo", x, y)
+                if i % 10 == 0 then AddScript(e, "test") end
+            end
+        )");
+        return Seconds(start);
+    }
+}
+
+int main() {
+    spdlog::set_level(spdlog::level::warn);
+    const int count = 100000;
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "momo_snapshot_benchmark.snap";
+
+    EntityManager fromLua;
+    double lua = BuildFromLua(fromLua, count);
+
+    EntityManager fromCpp;
+    auto start = std::chrono::steady_clock::now();
+    BuildLevel(fromCpp, count);
+    double cpp = Seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    if (!fromCpp.SaveSnapshot(path)) return 1;
+    double save = Seconds(start);
+
+    EntityManager fromSnapshot;
+    start = std::chrono::steady_clock::now();
+    if (!fromSnapshot.LoadSnapshot(path)) return 1;
+    double load = Seconds(start);
+
+    std::size_t loaded = fromSnapshot.GetView<const Position, const momoengine::Sprite>().Size();
+    std::cout << count << " entities: Lua construction " << lua * 1000.0 << " ms, C++ construction " << cpp * 1000.0
+        << " ms, SaveSnapshot " << save * 1000.0 << " ms, LoadSnapshot " << load * 1000.0 << " ms ("
+        << std::filesystem::file_size(path) / 1024 << " KiB, " << loaded << " entities loaded)\n";
+
+    std::filesystem::remove(path);
+    return loaded == (std::size_t)count ? 0 : 1;
+}
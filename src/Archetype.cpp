@@ -0,0 +1,210 @@
+#include "Archetype.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "spdlog/spdlog.h"
+
+namespace {
+	std::size_t AlignUp(std::size_t value, std::size_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+ComponentId ComponentInfo::NextId() {
+	static std::atomic<ComponentId> next{ 0 };
+	return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+namespace {
+	//runtime-registered types live for the whole program, like the static ones from Get<T>()
+	struct RuntimeTypes {
+		std::mutex mutex;
+		std::vector<std::unique_ptr<ComponentInfo>> types;
+	};
+
+	RuntimeTypes& GetRuntimeTypes() {
+		static RuntimeTypes runtimeTypes;
+		return runtimeTypes;
+	}
+}
+
+const ComponentInfo* ComponentInfo::Register(const std::string& name, std::size_t size, std::size_t align) {
+	RuntimeTypes& runtime = GetRuntimeTypes();
+	std::lock_guard<std::mutex> lock(runtime.mutex);
+
+	for (const auto& type : runtime.types) {
+		if (type->name != name) continue;
+		if (type->size != size || type->align != align) {
+			spdlog::error("Component type '{}' is already registered with a different size", name);
+			return nullptr;
+		}
+		return type.get();
+	}
+
+	runtime.types.push_back(std::make_unique<ComponentInfo>(ComponentInfo{ NextId(), name, size, align, true, nullptr, nullptr, nullptr }));
+	return runtime.types.back().get();
+}
+
+const ComponentInfo* ComponentInfo::FindRegistered(const std::string& name) {
+	RuntimeTypes& runtime = GetRuntimeTypes();
+	std::lock_guard<std::mutex> lock(runtime.mutex);
+
+	for (const auto& type : runtime.types) {
+		if (type->name == name) return type.get();
+	}
+	return nullptr;
+}
+
+ChunkAllocator::~ChunkAllocator() {
+	for (FreeList& list : freeLists) {
+		for (std::byte* block : list.blocks) {
+			::operator delete(block, std::align_val_t(Archetype::ChunkAlign));
+		}
+	}
+}
+
+ChunkAllocator::FreeList& ChunkAllocator::ListFor(std::size_t bytes) {
+	for (FreeList& list : freeLists) {
+		if (list.bytes == bytes) return list;
+	}
+	freeLists.push_back({ bytes, {} });
+	return freeLists.back();
+}
+
+std::byte* ChunkAllocator::Allocate(std::size_t bytes) {
+	FreeList& list = ListFor(bytes);
+	++stats.inUse;
+
+	if (!list.blocks.empty()) {
+		std::byte* block = list.blocks.back();
+		list.blocks.pop_back();
+		++stats.reuses;
+		--stats.pooled;
+		return block;
+	}
+
+	++stats.heapAllocations;
+	return static_cast<std::byte*>(::operator new(bytes, std::align_val_t(Archetype::ChunkAlign)));
+}
+
+void ChunkAllocator::Free(std::byte* data, std::size_t bytes) {
+	ListFor(bytes).blocks.push_back(data);
+	--stats.inUse;
+	++stats.pooled;
+}
+
+Archetype::Archetype(std::vector<const ComponentInfo*> componentTypes, ChunkAllocator& allocator)
+	: allocator(allocator), components(std::move(componentTypes)),
+	offsets(components.size()), addedOffsets(components.size()), changedOffsets(components.size()) {
+
+	for (std::size_t i = 0; i < components.size(); ++i) {
+		ComponentId id = components[i]->id;
+		if (id >= columnOfId.size()) columnOfId.resize(id + 1, -1);
+		columnOfId[id] = (int)i;
+	}
+
+	//computes the column offsets for a given row count and returns the bytes needed
+	auto layout = [&](std::size_t rows) {
+		std::size_t bytes = sizeof(Tick) * components.size();	//chunk change ticks
+		bytes = AlignUp(bytes, alignof(EntityId));
+		entitiesOffset = bytes;
+		bytes += sizeof(EntityId) * rows;
+		for (std::size_t i = 0; i < components.size(); ++i) {
+			bytes = AlignUp(bytes, std::max(components[i]->align, ChunkAlign));
+			offsets[i] = bytes;
+			bytes += components[i]->size * rows;
+			bytes = AlignUp(bytes, alignof(Tick));
+			addedOffsets[i] = bytes;
+			bytes += sizeof(Tick) * rows;
+			changedOffsets[i] = bytes;
+			bytes += sizeof(Tick) * rows;
+		}
+		return bytes;
+	};
+
+	//estimate rows per chunk, then shrink until the padded layout fits
+	std::size_t rowBytes = sizeof(EntityId);
+	for (const ComponentInfo* info : components) {
+		rowBytes += info->size + 2 * sizeof(Tick);
+	}
+	capacity = std::max<std::size_t>(1, ChunkBytes / rowBytes);
+	while (capacity > 1 && layout(capacity) > ChunkBytes) {
+		--capacity;
+	}
+	chunkBytes = std::max(ChunkBytes, layout(capacity));	//a single huge component gets a bigger chunk
+}
+
+Archetype::~Archetype() {
+	for (std::size_t c = 0; c < chunks.size(); ++c) {
+		for (std::size_t row = 0; row < chunks[c].count; ++row) {
+			for (std::size_t column = 0; column < components.size(); ++column) {
+				components[column]->Destroy(At({ c, row }, (int)column));
+			}
+		}
+		allocator.Free(chunks[c].data, chunkBytes);
+	}
+	if (spareChunk) {
+		allocator.Free(spareChunk, chunkBytes);
+	}
+}
+
+ArchetypeRow Archetype::Allocate(EntityId id, Tick tick) {
+	//every chunk except the last one is always full
+	if (chunks.empty() || chunks.back().count == capacity) {
+		Chunk chunk;
+		chunk.data = spareChunk ? spareChunk : allocator.Allocate(chunkBytes);
+		spareChunk = nullptr;
+		for (std::size_t column = 0; column < components.size(); ++column) {
+			ChunkChangedTick(chunk, (int)column) = 0;
+		}
+		chunks.push_back(chunk);
+	}
+
+	Chunk& chunk = chunks.back();
+	ArchetypeRow slot{ chunks.size() - 1, chunk.count++ };
+	Entities(chunk)[slot.row] = id;
+	for (std::size_t column = 0; column < components.size(); ++column) {
+		SetTicks(slot, (int)column, tick, tick);
+	}
+	++entityCount;
+	return slot;
+}
+
+void Archetype::SetTicks(const ArchetypeRow& slot, int column, Tick added, Tick changed) {
+	Chunk& chunk = chunks[slot.chunk];
+	AddedTicks(chunk, column)[slot.row] = added;
+	ChangedTicks(chunk, column)[slot.row] = changed;
+	ChunkChangedTick(chunk, column) = std::max(ChunkChangedTick(chunk, column), changed);
+}
+
+EntityId Archetype::Remove(const ArchetypeRow& slot) {
+	ArchetypeRow last{ chunks.size() - 1, chunks.back().count - 1 };
+	EntityId moved = NullEntityId;
+
+	for (std::size_t column = 0; column < components.size(); ++column) {
+		components[column]->Destroy(At(slot, (int)column));
+	}
+
+	//swap the last row into the hole so chunks stay packed
+	if (slot.chunk != last.chunk || slot.row != last.row) {
+		for (std::size_t column = 0; column < components.size(); ++column) {
+			components[column]->Move(At(slot, (int)column), At(last, (int)column));
+			components[column]->Destroy(At(last, (int)column));
+			SetTicks(slot, (int)column, AddedTick(last, (int)column), ChangedTick(last, (int)column));
+		}
+		moved = Entities(chunks[last.chunk])[last.row];
+		Entities(chunks[slot.chunk])[slot.row] = moved;
+	}
+
+	--entityCount;
+	if (--chunks.back().count == 0) {
+		if (spareChunk) {
+			allocator.Free(spareChunk, chunkBytes);
+		}
+		spareChunk = chunks.back().data;
+		chunks.pop_back();
+	}
+	return moved;
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <typeinfo>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <new>		//for placement new
+#include <type_traits>
+#include <utility>
+
+using EntityId = std::uint32_t;	//handle stored next to each row; EntityManager::Entity is an alias for this
+constexpr EntityId NullEntityId = ~EntityId(0);	//never handed out as a live entity
+
+using Tick = std::uint32_t;	//EntityManager change counter; components remember when they were added and last changed
+
+using ComponentId = std::uint32_t;	//dense per-type number, used to index flat arrays instead of hashing type_index
+
+//type-erased description of a component, so archetypes can store it without knowing T
+//C++ types get theirs from Get<T>(); types that only exist at runtime (e.g. defined from Lua) come from Register()
+struct ComponentInfo {
+	ComponentId id;
+	std::string name;
+	std::size_t size;
+	std::size_t align;
+	bool trivial;	//plain bytes: moved, copied and destroyed with memcpy/no-op instead of the thunks below
+	void (*moveConstruct)(void* dst, void* src);	//moves src into uninitialized memory at dst
+	void (*copyConstruct)(void* dst, const void* src);	//copies src into uninitialized memory at dst; nullptr for move-only types
+	void (*destroy)(void* ptr);		//runs the destructor in place
+
+	void Move(void* dst, void* src) const {
+		if (trivial) std::memcpy(dst, src, size);
+		else moveConstruct(dst, src);
+	}
+	void Copy(void* dst, const void* src) const {
+		if (trivial) std::memcpy(dst, src, size);
+		else copyConstruct(dst, src);
+	}
+	void Destroy(void* ptr) const {
+		if (!trivial) destroy(ptr);
+	}
+	bool Copyable() const { return trivial || copyConstruct; }
+
+	template <typename T>
+	static const ComponentInfo* Get();
+
+	//registers a runtime-only component type of `size` plain bytes (zero-filled when added)
+	//returns the existing type if `name` was registered before with the same size
+	static const ComponentInfo* Register(const std::string& name, std::size_t size, std::size_t align = alignof(std::max_align_t));
+	static const ComponentInfo* FindRegistered(const std::string& name);	//nullptr if no runtime type has that name
+
+	static ComponentId NextId();	//hands out the next dense ID; thread-safe
+
+private:
+	template <typename T>
+	static constexpr void (*CopyThunk())(void*, const void*) {
+		if constexpr (std::is_copy_constructible_v<T>) {
+			return [](void* dst, const void* src) { new (dst) T(*static_cast<const T*>(src)); };
+		}
+		else {
+			return nullptr;
+		}
+	}
+};
+
+//one static ComponentInfo per type; the ID is taken the first time a type is used
+template <typename T>
+const ComponentInfo* ComponentInfo::Get() {
+	static const ComponentInfo info{
+		NextId(),
+		typeid(T).name(),
+		sizeof(T),
+		alignof(T),
+		std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>,
+		[](void* dst, void* src) { new (dst) T(std::move(*static_cast<T*>(src))); },
+		CopyThunk<T>(),
+		[](void* ptr) { static_cast<T*>(ptr)->~T(); }
+	};
+	return &info;
+}
+
+//per-type ID without going through the ComponentInfo pointer
+template <typename T>
+ComponentId ComponentIdOf() {
+	static const ComponentId id = ComponentInfo::Get<std::remove_const_t<T>>()->id;
+	return id;
+}
+
+//recycles chunk memory so that steady-state structural changes don't touch the heap
+//chunks are mostly Archetype::ChunkBytes, so free blocks are kept in one list per block size
+class ChunkAllocator {
+public:
+	struct Stats {
+		std::size_t heapAllocations = 0;	//blocks that had to come from operator new
+		std::size_t reuses = 0;		//blocks handed out from a free list
+		std::size_t inUse = 0;
+		std::size_t pooled = 0;		//free blocks waiting to be reused
+	};
+
+	ChunkAllocator() = default;
+	~ChunkAllocator();
+
+	ChunkAllocator(const ChunkAllocator&) = delete;
+	ChunkAllocator& operator=(const ChunkAllocator&) = delete;
+
+	std::byte* Allocate(std::size_t bytes);
+	void Free(std::byte* data, std::size_t bytes);
+
+	const Stats& GetStats() const { return stats; }
+
+private:
+	struct FreeList {
+		std::size_t bytes;
+		std::vector<std::byte*> blocks;
+	};
+	std::vector<FreeList> freeLists;
+	Stats stats;
+
+	FreeList& ListFor(std::size_t bytes);
+};
+
+//fixed-size block holding up to Archetype::ChunkCapacity() rows as structure-of-arrays:
+//[newest change tick per column][entity IDs...][column 0...][column 0 added ticks...][column 0 changed ticks...][column 1...]
+struct Chunk {
+	std::byte* data = nullptr;
+	std::size_t count = 0;	//rows in use
+};
+
+//position of an entity's row inside an archetype
+struct ArchetypeRow {
+	std::size_t chunk = 0;
+	std::size_t row = 0;
+};
+
+//stores every entity that has exactly the same set of components
+class Archetype {
+public:
+	static constexpr std::size_t ChunkBytes = 16 * 1024;	//size of one chunk
+	static constexpr std::size_t ChunkAlign = 64;		//cache line alignment for every column
+
+	//componentTypes must be sorted by id; chunk memory comes from (and goes back to) allocator
+	Archetype(std::vector<const ComponentInfo*> componentTypes, ChunkAllocator& allocator);
+	~Archetype();
+
+	Archetype(const Archetype&) = delete;
+	Archetype& operator=(const Archetype&) = delete;
+
+	const std::vector<const ComponentInfo*>& Components() const { return components; }
+	//returns -1 if the type isn't stored here; a flat lookup indexed by ComponentId
+	int ColumnOf(ComponentId type) const { return type < columnOfId.size() ? columnOfId[type] : -1; }
+	bool Has(ComponentId type) const { return ColumnOf(type) >= 0; }
+
+	std::size_t ChunkCapacity() const { return capacity; }
+	std::size_t ChunkCount() const { return chunks.size(); }
+	std::size_t Size() const { return entityCount; }
+	Chunk& GetChunk(std::size_t index) { return chunks[index]; }
+
+	EntityId* Entities(Chunk& chunk) const { return reinterpret_cast<EntityId*>(chunk.data + entitiesOffset); }
+	void* Column(Chunk& chunk, int column) const { return chunk.data + offsets[column]; }
+
+	//per-row change tracking for each column
+	Tick* AddedTicks(Chunk& chunk, int column) const { return reinterpret_cast<Tick*>(chunk.data + addedOffsets[column]); }
+	Tick* ChangedTicks(Chunk& chunk, int column) const { return reinterpret_cast<Tick*>(chunk.data + changedOffsets[column]); }
+
+	//newest changed tick of any row in the column, so unchanged chunks can be skipped whole
+	Tick& ChunkChangedTick(Chunk& chunk, int column) const { return reinterpret_cast<Tick*>(chunk.data)[column]; }
+
+	void MarkChanged(const ArchetypeRow& slot, int column, Tick tick) {
+		Chunk& chunk = chunks[slot.chunk];
+		ChangedTicks(chunk, column)[slot.row] = tick;
+		ChunkChangedTick(chunk, column) = tick;
+	}
+
+	//overwrites a row's ticks, e.g. to carry them over when the entity moves archetype
+	void SetTicks(const ArchetypeRow& slot, int column, Tick added, Tick changed);
+	Tick AddedTick(const ArchetypeRow& slot, int column) { return AddedTicks(chunks[slot.chunk], column)[slot.row]; }
+	Tick ChangedTick(const ArchetypeRow& slot, int column) { return ChangedTicks(chunks[slot.chunk], column)[slot.row]; }
+
+	template <typename T>
+	T* Column(Chunk& chunk, int column) const { return reinterpret_cast<T*>(Column(chunk, column)); }
+
+	//address of one component in a row
+	void* At(const ArchetypeRow& slot, int column) {
+		return static_cast<std::byte*>(Column(chunks[slot.chunk], column)) + slot.row * components[column]->size;
+	}
+
+	//reserves a row for the entity and stamps every column as added and changed at `tick`
+	//component memory is left uninitialized for the caller to construct
+	ArchetypeRow Allocate(EntityId id, Tick tick);
+
+	//destroys the row's components and fills the hole with the last row
+	//returns the entity that was moved into the slot, or NullEntityId if nothing moved
+	EntityId Remove(const ArchetypeRow& slot);
+
+	//cached transitions to the archetype with one component added or removed, indexed by ComponentId
+	Archetype* AddEdge(ComponentId type) const { return type < addEdges.size() ? addEdges[type] : nullptr; }
+	Archetype* RemoveEdge(ComponentId type) const { return type < removeEdges.size() ? removeEdges[type] : nullptr; }
+	void SetAddEdge(ComponentId type, Archetype* to) { SetEdge(addEdges, type, to); }
+	void SetRemoveEdge(ComponentId type, Archetype* to) { SetEdge(removeEdges, type, to); }
+
+private:
+	ChunkAllocator& allocator;
+	std::vector<const ComponentInfo*> components;
+	std::vector<int> columnOfId;	//ComponentId -> column, -1 when absent; sized to the largest ID stored here
+	std::vector<Archetype*> addEdges;
+	std::vector<Archetype*> removeEdges;
+	std::vector<std::size_t> offsets;	//byte offset of each column inside a chunk
+	std::vector<std::size_t> addedOffsets;
+	std::vector<std::size_t> changedOffsets;
+	std::size_t entitiesOffset = 0;
+	std::size_t capacity = 0;	//rows per chunk
+	std::size_t chunkBytes = ChunkBytes;
+	std::size_t entityCount = 0;
+	std::vector<Chunk> chunks;
+	std::byte* spareChunk = nullptr;	//last emptied chunk, kept so a row moving in and out doesn't ping-pong the allocator
+
+	static void SetEdge(std::vector<Archetype*>& edges, ComponentId type, Archetype* to) {
+		if (type >= edges.size()) edges.resize(type + 1, nullptr);
+		edges[type] = to;
+	}
+};
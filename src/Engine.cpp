@@ -4,6 +4,11 @@
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
 namespace momoengine {
 
     void Engine::Startup() {
@@ -17,9 +22,16 @@ namespace momoengine {
         input.Startup(graphics.GetWindow());    //gives input manager access to a window
 
         scripts.Startup(this, &input, &graphics);
+
+        jobs.Startup();
+        entities.SetJobSystem(&jobs);
+        graphics.SetJobSystem(&jobs);   //texture decoding
     }
 
     void Engine::Shutdown() {
+        entities.SetJobSystem(nullptr);
+        graphics.SetJobSystem(nullptr);     //waits for texture decodes still running
+        jobs.Shutdown();
         scripts.Shutdown();
         input.Shutdown();
         graphics.Shutdown();
@@ -41,27 +53,100 @@ namespace momoengine {
             return;
         }
 
-        double previousTime = glfwGetTime();    //initial time in seconds
-        double accumulatedTime = 0.0;   //stores amount of time between updates
-        const double tickRate = 1.0 / 60.0;     //60 updates per second
+        //logs once a second, so debug logs stay readable
+        const unsigned long long logInterval = std::max(1L, std::lround(1.0 / pacer.TickInterval()));
+        unsigned long long ticks = 0;
+        pacer.Start();
 
         while (!glfwWindowShouldClose(window)) {    //while the window is open
             input.Update();     //uses glfwPollEvents(), which polls input events
 
-            double currentTime = glfwGetTime();     //current time in seconds
-            double elapsedTime = currentTime - previousTime;    //calculates time passed between loops
-            previousTime = currentTime;     //updates the amount of time spent
+            //the ticks that came due since the last pass, only a few if the last one stalled
+            int due = pacer.TicksDue();
+            for (int i = 0; i < due; ++i) {
+                if (callback) callback();   //calls update function
+                systems.Run(entities, jobs);
+                entities.AdvanceFrame();
+                pacer.EndTick();
+
+                if (++ticks % logInterval == 0) {
+                    systems.LogTimings();
+                    pacer.LogFrameTimes();
+                }
+            }
+            if (due > 0) pacer.RecordFrame();   //sprites are drawn by a system, so a pass that ticked is a frame
+
+            //sleep until the next tick is due instead of spinning on the clock
+            pacer.WaitForTick();
+        }
+    }
+
+    void Engine::RunThreadedGameLoop(const UpdateCallback& callback) {
+        auto* window = graphics.GetWindow();
+        if (!window) {
+            spdlog::error("RunThreadedGameLoop called with no valid window; Startup() may have failed.");
+            return;
+        }
+
+        const double tickInterval = pacer.TickInterval();
+        const unsigned long long logInterval = std::max(1L, std::lround(1.0 / tickInterval));
+        std::atomic<bool> running{ true };
+        pacer.Start();
+
+        //GLFW wants its events and window on the main thread, so the simulation is the one that moves
+        std::thread simulation([&] {
+            unsigned long long ticks = 0;
+
+            while (running.load(std::memory_order_relaxed)) {
+                int due = pacer.TicksDue();
+                for (int i = 0; i < due; ++i) {
+                    if (callback) callback();
+                    systems.Run(entities, jobs);
+
+                    GraphicsManager::RenderSnapshot& snapshot = snapshots.Back();
+                    graphics.Extract(entities, snapshot);
+                    snapshot.time = pacer.TickTime();
+                    snapshots.Publish();
+
+                    entities.AdvanceFrame();
+                    pacer.EndTick();
+
+                    //system timings once a second, so debug logs stay readable
+                    if (++ticks % logInterval == 0) {
+                        systems.LogTimings();
+                    }
+                }
+
+                //sleep instead of spinning, so the render thread has the core
+                pacer.WaitForTick();
+            }
+        });
 
-            accumulatedTime += elapsedTime;     //adds time spent
+        //frames are paced by the present mode: Fifo waits for vblank, Mailbox and Immediate don't
+        bool has_snapshot = false;
+        while (!glfwWindowShouldClose(window)) {
+            input.Update();
 
-            //if the elapsed time has somehow surpassed the tick rate
-            while (accumulatedTime >= tickRate) {
-                // InputManager::Update()
-                callback();   //calls update function
-                accumulatedTime -= tickRate;
+            has_snapshot |= snapshots.Acquire();
+            if (!has_snapshot) {
+                std::this_thread::yield();  //the first tick hasn't finished yet
+                continue;
+            }
+
+            //drawn one tick behind the simulation: at the newest tick's time it shows the tick before,
+            //and a tick later it reaches the newest one
+            const GraphicsManager::RenderSnapshot& snapshot = snapshots.Front();
+            double alpha = std::clamp((FramePacer::Now() - snapshot.time) / tickInterval, 0.0, 1.0);
+            graphics.Render(snapshot, (float)alpha);
+
+            pacer.RecordFrame();
+            if (pacer.GetFrameTimes().frames % logInterval == 0) {
+                pacer.LogFrameTimes();
             }
         }
-    }
 
+        running = false;
+        simulation.join();
+    }
 
 }
@@ -3,6 +3,10 @@
 #include "InputManager.h"
 #include "ScriptManager.h"
 #include "EntityManager.h"
+#include "JobSystem.h"
+#include "SystemScheduler.h"
+#include "TripleBuffer.h"
+#include "FramePacer.h"
 #include <functional>
 
 namespace momoengine {
@@ -14,17 +18,34 @@ namespace momoengine {
         void Quit();    //allows other windows to quit
 
         using UpdateCallback = std::function<void()>;
-        void RunGameLoop(const UpdateCallback& callback);     //runs the main game loop
+        void RunGameLoop(const UpdateCallback& callback = nullptr);     //runs the main game loop
+
+        //like RunGameLoop, but the callback and systems tick on a simulation thread while this thread renders
+        //every tick is published as a snapshot, and frames blend the newest two so motion stays smooth at any frame rate
+        //sprites are drawn by the loop itself, so don't add a system that calls Draw()
+        void RunThreadedGameLoop(const UpdateCallback& callback = nullptr);
+
+        //registers a system that runs every tick after the callback; declare its access on the returned system
+        SystemScheduler::System& AddSystem(std::string name, SystemScheduler::SystemFunc func) {
+            return systems.Add(std::move(name), std::move(func));
+        }
+        const std::vector<SystemScheduler::Timing>& GetSystemTimings() const { return systems.Timings(); }
 
         InputManager& GetInput() { return input; }
         GraphicsManager& GetGraphics() { return graphics; }
         ScriptManager& GetScripts() { return scripts;  }
         EntityManager& GetEntityManager() { return entities; }
+        JobSystem& GetJobs() { return jobs; }
+        FramePacer& GetPacer() { return pacer; }    //tick rate, catch-up limit and frame times
     
     private:
         GraphicsManager graphics;   //adds GraphicsManager window
         InputManager input;          //grabs keyboard/mouse input
         ScriptManager scripts;
         EntityManager entities;
+        JobSystem jobs;     //worker threads for ParallelForEach and systems
+        SystemScheduler systems;
+        FramePacer pacer;
+        TripleBuffer<GraphicsManager::RenderSnapshot> snapshots;    //simulation -> render thread in RunThreadedGameLoop
     };
 }
@@ -0,0 +1,114 @@
+#include "EntityCommandBuffer.h"
+
+#include <algorithm>
+
+namespace {
+	std::size_t AlignUp(std::size_t value, std::size_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+EntityCommandBuffer::~EntityCommandBuffer() {
+	Clear();
+	for (std::byte* block : blocks) {
+		::operator delete(block, std::align_val_t(BlockAlign));
+	}
+}
+
+EntityCommandBuffer::Entity EntityCommandBuffer::CreateEntity() {
+	Entity id = entities.ReserveEntity();
+	Command header{
+		[](EntityManager& entities, Command* c) { entities.CreateReserved(static_cast<EntityCommand*>(c)->id); },
+		[](EntityManager& entities, Command* c) { entities.ReleaseReserved(static_cast<EntityCommand*>(c)->id); },
+		[](Command*) {}
+	};
+	commands.push_back(new (Allocate(sizeof(EntityCommand), alignof(EntityCommand))) EntityCommand{ header, id });
+	return id;
+}
+
+void EntityCommandBuffer::DestroyEntity(Entity id) {
+	Command header{
+		[](EntityManager& entities, Command* c) { entities.DestroyEntity(static_cast<EntityCommand*>(c)->id); },
+		nullptr,
+		[](Command*) {}
+	};
+	commands.push_back(new (Allocate(sizeof(EntityCommand), alignof(EntityCommand))) EntityCommand{ header, id });
+}
+
+void EntityCommandBuffer::AddRuntimeComponent(Entity id, const ComponentInfo& type) {
+	Command header{
+		[](EntityManager& entities, Command* c) {
+			RuntimeCommand* add = static_cast<RuntimeCommand*>(c);
+			entities.AddRuntimeComponent(add->id, *add->type);
+		},
+		nullptr,
+		[](Command*) {}
+	};
+	commands.push_back(new (Allocate(sizeof(RuntimeCommand), alignof(RuntimeCommand))) RuntimeCommand{ header, id, &type });
+}
+
+void EntityCommandBuffer::RemoveRuntimeComponent(Entity id, const ComponentInfo& type) {
+	Command header{
+		[](EntityManager& entities, Command* c) {
+			RuntimeCommand* remove = static_cast<RuntimeCommand*>(c);
+			entities.RemoveRuntimeComponent(remove->id, *remove->type);
+		},
+		nullptr,
+		[](Command*) {}
+	};
+	commands.push_back(new (Allocate(sizeof(RuntimeCommand), alignof(RuntimeCommand))) RuntimeCommand{ header, id, &type });
+}
+
+void EntityCommandBuffer::Flush() {
+	for (Command* command : commands) {
+		command->apply(entities, command);
+	}
+	Release();
+}
+
+void EntityCommandBuffer::Clear() {
+	for (Command* command : commands) {
+		if (command->discard) command->discard(entities, command);
+	}
+	Release();
+}
+
+void EntityCommandBuffer::Release() {
+	for (Command* command : commands) {
+		command->destroy(command);
+	}
+	commands.clear();
+
+	for (auto& [data, align] : oversized) {
+		::operator delete(data, std::align_val_t(align));
+	}
+	oversized.clear();
+
+	//keep the blocks for the next batch
+	blockIndex = 0;
+	blockOffset = 0;
+}
+
+void* EntityCommandBuffer::Allocate(std::size_t size, std::size_t align) {
+	//rare huge or over-aligned commands get their own allocation
+	if (size > BlockBytes || align > BlockAlign) {
+		align = std::max(align, alignof(std::max_align_t));
+		std::byte* data = static_cast<std::byte*>(::operator new(size, std::align_val_t(align)));
+		oversized.push_back({ data, align });
+		return data;
+	}
+
+	blockOffset = AlignUp(blockOffset, align);
+	if (blockIndex < blocks.size() && blockOffset + size > BlockBytes) {
+		++blockIndex;	//current block is full, move to the next one
+		blockOffset = 0;
+	}
+	if (blockIndex == blocks.size()) {
+		blocks.push_back(static_cast<std::byte*>(::operator new(BlockBytes, std::align_val_t(BlockAlign))));
+		blockOffset = 0;
+	}
+
+	void* result = blocks[blockIndex] + blockOffset;
+	blockOffset += size;
+	return result;
+}
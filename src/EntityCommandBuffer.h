@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include "EntityManager.h"
+
+//records structural changes so they can be requested while a ForEach is running,
+//then applies all of them in recorded order with one Flush() once iteration is over
+//not thread-safe: use one buffer per thread, and only record CreateEntity() on the main thread
+class EntityCommandBuffer {
+public:
+	using Entity = EntityManager::Entity;
+
+	explicit EntityCommandBuffer(EntityManager& entities) : entities(entities) {}
+	~EntityCommandBuffer();
+
+	EntityCommandBuffer(const EntityCommandBuffer&) = delete;
+	EntityCommandBuffer& operator=(const EntityCommandBuffer&) = delete;
+
+	//the handle can be used by later commands in this buffer; the entity exists once the buffer is flushed
+	Entity CreateEntity();
+	void DestroyEntity(Entity id);
+
+	template <typename T>
+	void AddComponent(Entity id, T component);
+
+	template <typename T>
+	void RemoveComponent(Entity id);
+
+	//for component types registered at runtime; the added component starts zero-filled, as with AddRuntimeComponent
+	void AddRuntimeComponent(Entity id, const ComponentInfo& type);
+	void RemoveRuntimeComponent(Entity id, const ComponentInfo& type);
+
+	void Flush();	//applies every command in recorded order
+	void Clear();	//drops pending commands and gives back reserved handles
+
+	std::size_t Size() const { return commands.size(); }
+
+private:
+	struct Command {
+		void (*apply)(EntityManager& entities, Command* command);
+		void (*discard)(EntityManager& entities, Command* command);		//called instead of apply by Clear(); may be nullptr
+		void (*destroy)(Command* command);
+	};
+
+	template <typename T>
+	struct AddCommand : Command {
+		Entity id;
+		T component;
+	};
+
+	struct EntityCommand : Command {
+		Entity id;
+	};
+
+	struct RuntimeCommand : Command {
+		Entity id;
+		const ComponentInfo* type;
+	};
+
+	static constexpr std::size_t BlockBytes = 16 * 1024;
+	static constexpr std::size_t BlockAlign = 64;
+
+	//commands are placement-new'ed into reusable blocks so recording doesn't allocate once warmed up
+	std::vector<std::byte*> blocks;
+	std::vector<std::pair<std::byte*, std::size_t>> oversized;	//commands too big for a block, with their alignment
+	std::size_t blockIndex = 0;
+	std::size_t blockOffset = 0;
+
+	std::vector<Command*> commands;
+	EntityManager& entities;
+
+	void* Allocate(std::size_t size, std::size_t align);
+	void Release();		//destroys recorded commands and rewinds the blocks
+};
+
+template <typename T>
+void EntityCommandBuffer::AddComponent(Entity id, T component) {
+	using Add = AddCommand<T>;
+	Command header{
+		[](EntityManager& entities, Command* c) {
+			Add* add = static_cast<Add*>(c);
+			entities.AddComponent(add->id, std::move(add->component));
+		},
+		nullptr,
+		[](Command* c) { static_cast<Add*>(c)->~Add(); }
+	};
+	commands.push_back(new (Allocate(sizeof(Add), alignof(Add))) Add{ header, id, std::move(component) });
+}
+
+template <typename T>
+void EntityCommandBuffer::RemoveComponent(Entity id) {
+	Command header{
+		[](EntityManager& entities, Command* c) { entities.RemoveComponent<T>(static_cast<EntityCommand*>(c)->id); },
+		nullptr,
+		[](Command*) {}
+	};
+	commands.push_back(new (Allocate(sizeof(EntityCommand), alignof(EntityCommand))) EntityCommand{ header, id });
+}
@@ -3,23 +3,290 @@
 #include "Sprite.h"
 #include "spdlog/spdlog.h"
 
-//creates a new entity and its ID
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+EntityManager::EntityManager() {
+	emptyArchetype = FindOrCreateArchetype({});
+}
+
+//creates a new entity, reusing a freed index when one is available
 EntityManager::Entity EntityManager::CreateEntity() {
-	Entity id = nextEntityID++;
-	spdlog::info("Created entity {}", id);
+	Entity id = AllocateHandle();
+	if (id == NullEntity) return id;
+
+	EntityLocation& location = locations[IndexOf(id)];
+	location.archetype = emptyArchetype;
+	location.slot = emptyArchetype->Allocate(id, currentTick);
+	spdlog::debug("Created entity {}", id);
 	return id;
 }
 
-//removes entity from every component table
+//removes entity, destroys all of its components and retires its handle
 void EntityManager::DestroyEntity(Entity id) {
-	for (auto& [type, table] : components) {
-		auto it = table.find(id);
-		if (it != table.end()) {
-			delete static_cast<char*>(it->second);	//generic delete
-			table.erase(it);
+	if (!IsAlive(id)) return;
+
+	std::uint32_t index = IndexOf(id);
+	EntityLocation& location = locations[index];
+	for (const ComponentInfo* info : location.archetype->Components()) {
+		RecordRemoved(id, info->id);
+	}
+	Entity moved = location.archetype->Remove(location.slot);
+	if (moved != NullEntity) {
+		locations[IndexOf(moved)].slot = location.slot;
+	}
+	location.archetype = nullptr;
+	FreeIndex(index);
+	spdlog::debug("Destroyed entity {}", id);
+}
+
+std::vector<EntityManager::Entity> EntityManager::CreateEntities(std::size_t count) {
+	return Instantiate(Prefab{}, count);
+}
+
+std::vector<EntityManager::Entity> EntityManager::Instantiate(const Prefab& prefab, std::size_t count) {
+	//walk the add edges once for the whole batch
+	Archetype* archetype = emptyArchetype;
+	for (const Prefab::Entry& entry : prefab.Components()) {
+		archetype = ArchetypeWith(archetype, entry.info);
+	}
+
+	std::vector<int> columns;
+	for (const Prefab::Entry& entry : prefab.Components()) {
+		columns.push_back(archetype->ColumnOf(entry.info->id));
+	}
+
+	std::vector<Entity> created;
+	created.reserve(count);
+	for (std::size_t i = 0; i < count; ++i) {
+		Entity id = AllocateHandle();
+		if (id == NullEntity) break;
+
+		EntityLocation& location = locations[IndexOf(id)];
+		location.archetype = archetype;
+		location.slot = archetype->Allocate(id, currentTick);
+
+		const auto& entries = prefab.Components();
+		for (std::size_t c = 0; c < entries.size(); ++c) {
+			entries[c].info->Copy(archetype->At(location.slot, columns[c]), entries[c].data);
+		}
+		created.push_back(id);
+	}
+
+	spdlog::debug("Instantiated {} entities", created.size());
+	return created;
+}
+
+EntityManager::Entity EntityManager::ReserveEntity() {
+	Entity id = AllocateHandle();
+	if (id != NullEntity) {
+		locations[IndexOf(id)].reserved = true;
+	}
+	return id;
+}
+
+void EntityManager::CreateReserved(Entity id) {
+	std::uint32_t index = IndexOf(id);
+	if (index >= locations.size() || !locations[index].reserved || locations[index].generation != GenerationOf(id)) {
+		spdlog::error("CreateReserved called with an entity that isn't reserved: {}", id);
+		return;
+	}
+
+	EntityLocation& location = locations[index];
+	location.reserved = false;
+	location.archetype = emptyArchetype;
+	location.slot = emptyArchetype->Allocate(id, currentTick);
+}
+
+void EntityManager::ReleaseReserved(Entity id) {
+	std::uint32_t index = IndexOf(id);
+	if (index >= locations.size() || !locations[index].reserved || locations[index].generation != GenerationOf(id)) return;
+
+	locations[index].reserved = false;
+	FreeIndex(index);
+}
+
+EntityManager::Entity EntityManager::AllocateHandle() {
+	std::uint32_t index;
+	if (freeHead != NullEntity) {
+		index = freeHead;
+		freeHead = locations[index].nextFree;
+		if (freeHead == NullEntity) freeTail = NullEntity;
+	}
+	else {
+		index = (std::uint32_t)locations.size();
+		if (index >= IndexMask) {	//the all-ones index is reserved for NullEntity
+			spdlog::error("EntityManager ran out of entity indices ({} live entities)", index);
+			return NullEntity;
 		}
+		locations.emplace_back();
+	}
+
+	return (locations[index].generation << IndexBits) | index;
+}
+
+void EntityManager::FreeIndex(std::uint32_t index) {
+	EntityLocation& location = locations[index];
+	location.generation = (location.generation + 1) & GenerationMask;	//invalidates outstanding handles
+
+	//append to the free list
+	location.nextFree = NullEntity;
+	if (freeTail != NullEntity) {
+		locations[freeTail].nextFree = index;
+	}
+	else {
+		freeHead = index;
+	}
+	freeTail = index;
+}
+
+bool EntityManager::IsAlive(Entity id) const {
+	std::uint32_t index = IndexOf(id);
+	return id != NullEntity
+		&& index < locations.size()
+		&& locations[index].archetype != nullptr
+		&& locations[index].generation == GenerationOf(id);
+}
+
+//returns the archetype for exactly this set of component types, creating it the first time
+Archetype* EntityManager::FindOrCreateArchetype(std::vector<const ComponentInfo*> componentTypes) {
+	std::sort(componentTypes.begin(), componentTypes.end(),
+		[](const ComponentInfo* a, const ComponentInfo* b) { return a->id < b->id; });
+
+	std::vector<ComponentId> key;
+	for (const ComponentInfo* info : componentTypes) {
+		key.push_back(info->id);
+	}
+
+	auto it = archetypeLookup.find(key);
+	if (it != archetypeLookup.end()) return it->second;
+
+	archetypes.push_back(std::make_unique<Archetype>(std::move(componentTypes), chunkAllocator));
+	Archetype* archetype = archetypes.back().get();
+	archetypeLookup.emplace(std::move(key), archetype);
+
+	//keep cached views up to date
+	for (auto& view : views) {
+		if (view) view->OnArchetypeCreated(*archetype);
+	}
+	return archetype;
+}
+
+Archetype* EntityManager::ArchetypeWith(Archetype* from, const ComponentInfo* added) {
+	if (Archetype* edge = from->AddEdge(added->id)) return edge;
+
+	std::vector<const ComponentInfo*> componentTypes = from->Components();
+	componentTypes.push_back(added);
+	Archetype* to = FindOrCreateArchetype(std::move(componentTypes));
+
+	from->SetAddEdge(added->id, to);
+	to->SetRemoveEdge(added->id, from);
+	return to;
+}
+
+Archetype* EntityManager::ArchetypeWithout(Archetype* from, ComponentId removed) {
+	if (Archetype* edge = from->RemoveEdge(removed)) return edge;
+
+	std::vector<const ComponentInfo*> componentTypes;
+	for (const ComponentInfo* info : from->Components()) {
+		if (info->id != removed) componentTypes.push_back(info);
+	}
+	Archetype* to = FindOrCreateArchetype(std::move(componentTypes));
+
+	from->SetRemoveEdge(removed, to);
+	to->SetAddEdge(removed, from);
+	return to;
+}
+
+//moves an entity's row to another archetype, carrying over the components both have in common
+void EntityManager::MoveEntity(Entity id, Archetype* to) {
+	EntityLocation& location = locations[IndexOf(id)];
+	Archetype* from = location.archetype;
+	ArchetypeRow target = to->Allocate(id, currentTick);
+
+	const auto& fromTypes = from->Components();
+	for (std::size_t column = 0; column < fromTypes.size(); ++column) {
+		int toColumn = to->ColumnOf(fromTypes[column]->id);
+		if (toColumn >= 0) {
+			fromTypes[column]->Move(to->At(target, toColumn), from->At(location.slot, (int)column));
+			to->SetTicks(target, toColumn, from->AddedTick(location.slot, (int)column), from->ChangedTick(location.slot, (int)column));
+		}
+	}
+
+	//destroys the moved-from (and dropped) components and fills the hole
+	Entity moved = from->Remove(location.slot);
+	if (moved != NullEntity) {
+		locations[IndexOf(moved)].slot = location.slot;
+	}
+
+	location.archetype = to;
+	location.slot = target;
+}
+
+void* EntityManager::FindComponent(Entity id, ComponentId type, bool markChanged) {
+	if (!IsAlive(id)) return nullptr;
+
+	EntityLocation& location = locations[IndexOf(id)];
+	int column = location.archetype->ColumnOf(type);
+	if (column < 0) return nullptr;
+
+	if (markChanged) {
+		location.archetype->MarkChanged(location.slot, column, currentTick);
+	}
+	return location.archetype->At(location.slot, column);
+}
+
+void* EntityManager::AddRuntimeComponent(Entity id, const ComponentInfo& type) {
+	if (!IsAlive(id)) {
+		spdlog::error("AddComponent called on dead or stale entity {}", id);
+		return nullptr;
+	}
+	if (!type.trivial) {
+		spdlog::error("AddRuntimeComponent needs a plain-byte component type, {} isn't one", type.name);
+		return nullptr;
+	}
+	if (void* existing = FindComponent(id, type.id, true)) return existing;
+
+	EntityLocation& location = locations[IndexOf(id)];
+	Archetype* target = ArchetypeWith(location.archetype, &type);
+	MoveEntity(id, target);
+	void* component = target->At(location.slot, target->ColumnOf(type.id));
+	std::memset(component, 0, type.size);
+	return component;
+}
+
+void* EntityManager::GetRuntimeComponent(Entity id, const ComponentInfo& type) {
+	return FindComponent(id, type.id, true);
+}
+
+const void* EntityManager::ReadRuntimeComponent(Entity id, const ComponentInfo& type) {
+	return FindComponent(id, type.id);
+}
+
+void EntityManager::RemoveRuntimeComponent(Entity id, const ComponentInfo& type) {
+	if (!FindComponent(id, type.id)) return;
+
+	MoveEntity(id, ArchetypeWithout(locations[IndexOf(id)].archetype, type.id));
+	RecordRemoved(id, type.id);
+}
+
+std::uint32_t EntityManager::NextViewId() {
+	static std::atomic<std::uint32_t> next{ 0 };
+	return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EntityManager::RecordRemoved(Entity id, ComponentId type) {
+	if (type >= removed.size()) removed.resize(type + 1);
+	removed[type].push_back({ id, currentTick });
+}
+
+//removals stay visible for the rest of this frame and all of the next one
+void EntityManager::AdvanceFrame() {
+	for (auto& records : removed) {
+		std::erase_if(records, [&](const RemovedRecord& record) { return record.tick < frameStartTick; });
 	}
-	spdlog::info("Destroyed entity {}", id);
+	frameStartTick = ++currentTick;		//a new tick so this frame's records can be told apart from the last one's
 }
 
 //explicit template instantiations for all component types
@@ -1,102 +1,567 @@
 #pragma once
 
-#include <unordered_map>
-#include <typeindex>	//for using typeid(T)
+#include <algorithm>
 #include <functional>	//for ForEach()
 #include <vector>
+#include <map>
+#include <unordered_map>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <filesystem>
+#include "Archetype.h"
+#include "Prefab.h"
+#include "JobSystem.h"
 #include "spdlog/spdlog.h"
 
+//query filters: only visit entities whose T was changed (or added) after the `since` tick
+//a component counts as changed when it is added, fetched mutably, visited as non-const T in a ForEach, or MarkChanged
+template <typename T>
+struct Changed {
+	using Component = T;
+	static constexpr bool AddedOnly = false;
+	Tick since = 0;
+};
+
+template <typename T>
+struct Added {
+	using Component = T;
+	static constexpr bool AddedOnly = true;
+	Tick since = 0;
+};
+
+//stores components in archetypes: entities with the same component set share contiguous SoA chunks
 class EntityManager {
 public:
-	using Entity = int;		//defines Entity as a type alias for an integer ID
+	//handle = index into the entity table (low bits) + generation of that slot (high bits)
+	//destroyed indices are recycled with a bumped generation, so stale handles can be detected
+	using Entity = EntityId;
+	static constexpr Entity NullEntity = NullEntityId;
+	static constexpr std::uint32_t IndexBits = 20;
+	static constexpr std::uint32_t IndexMask = (1u << IndexBits) - 1;
+	static constexpr std::uint32_t GenerationMask = (1u << (32 - IndexBits)) - 1;
+
+	static std::uint32_t IndexOf(Entity id) { return id & IndexMask; }
+	static std::uint32_t GenerationOf(Entity id) { return id >> IndexBits; }
+
+	using Tick = ::Tick;
+
+	EntityManager();
 
 	Entity CreateEntity();
 	void DestroyEntity(Entity id);
+	bool IsAlive(Entity id) const;	//false for destroyed entities and stale handles
+
+	//creates `count` entities with no components in one pass
+	std::vector<Entity> CreateEntities(std::size_t count);
+
+	//creates `count` entities holding a copy of every prefab component, placed straight into their final archetype
+	std::vector<Entity> Instantiate(const Prefab& prefab, std::size_t count);
+
+	//hands out a handle without creating the entity yet; it isn't alive until CreateReserved()
+	//lets EntityCommandBuffer return usable handles while a ForEach is running (main thread only)
+	Entity ReserveEntity();
+	void CreateReserved(Entity id);
+	void ReleaseReserved(Entity id);	//gives back a reserved handle that will never be created
 
     //using generics for type safety
-	template <typename T>   
+	template <typename T>
 	void AddComponent(Entity id, const T& c);
 
+	//moves the component in instead of copying it
+	template <typename T> requires (!std::is_lvalue_reference_v<T>)
+	void AddComponent(Entity id, T&& c);
+
+	//constructs the component in place inside its chunk
+	template <typename T, typename... Args>
+	T& EmplaceComponent(Entity id, Args&&... args);
+
+    //returns a writable reference, so the component is marked as changed
     template <typename T>
     T& GetComponent(Entity id);
 
+    //same lookup as GetComponent without marking the component as changed
+    template <typename T>
+    const T& ReadComponent(Entity id);
+
     template <typename T>
     void RemoveComponent(Entity id);
 
+    template <typename T>
+    void MarkChanged(Entity id);
+
+    //untyped versions for component types registered at runtime (see ComponentInfo::Register), e.g. from Lua
+    //AddRuntimeComponent zero-fills plain-byte types and returns the component; an existing one is returned as is
+    void* AddRuntimeComponent(Entity id, const ComponentInfo& type);
+    void* GetRuntimeComponent(Entity id, const ComponentInfo& type);	//marks changed; nullptr if missing
+    const void* ReadRuntimeComponent(Entity id, const ComponentInfo& type);
+    void RemoveRuntimeComponent(Entity id, const ComponentInfo& type);
+
+    //calls func(entity, components...) for every entity that has all the components
+    //list a component as `const T` for read-only access; non-const components are marked as changed
+    //structural changes (create/destroy/add/remove) are not allowed inside func
     template <typename... Components, typename Func>
     void ForEach(Func func);
 
+    //same, but only for entities that pass a Changed<T>/Added<T> filter on one of the components
+    template <typename... Components, typename Filter, typename Func>
+    void ForEach(Filter filter, Func func);
+
+    //change ticks: a system remembers the tick MarkTick() returned and passes it as `since` next time
+    //MarkTick() may be called while other threads iterate; they stamp whichever tick is current
+    Tick CurrentTick() const { return currentTick; }
+    Tick MarkTick() { return currentTick++; }   //returns the current tick and starts a new one
+
+    //calls func(entity) for every entity that lost its T (removed or destroyed) after `since`
+    //removals are kept until the end of the frame after the one they happened in
+    template <typename T, typename Func>
+    void ForEachRemoved(Tick since, Func func);
+
+    void AdvanceFrame();    //called once per frame by the engine to drop old removal records
+
+    //same as ForEach, but matching chunks are split across the job system's threads
+    //access rules while it runs:
+    //  - func is called concurrently and must not touch shared state without its own synchronization
+    //  - list a component as `const T` to declare read-only access; a non-const T may only be written
+    //    through the reference passed in for the current entity
+    //  - look up other entities with ReadComponent, and only for types no thread is writing during this call;
+    //    GetComponent stamps the changed tick, so two threads calling it on one entity race
+    //  - no structural changes and no Lua calls (the Lua state is single-threaded)
+    //falls back to ForEach when no job system has been set
+    template <typename... Components, typename Func>
+    void ParallelForEach(Func func);
+
+    void SetJobSystem(momoengine::JobSystem* jobSystem) { jobs = jobSystem; }
+
+    //writes every entity with its snapshot-registered components (see Snapshot.h) into one binary file
+    //components without a registered layout are left out with a warning
+    bool SaveSnapshot(const std::filesystem::path& path);
+
+    //recreates a saved world with the same entity handles; only works before any entity has been created
+    //the file is memory-mapped and trivially copyable columns are copied into chunks a chunk at a time
+    bool LoadSnapshot(const std::filesystem::path& path);
+
+    //chunk allocation counters; heapAllocations should stay flat once a scene reaches steady state
+    const ChunkAllocator::Stats& GetAllocationStats() const { return chunkAllocator.GetStats(); }
+
+    //persistent query over every entity with all of Components
+    template <typename... Components>
+    class View;
+
+    //returns the cached view for this component set; the reference stays valid for the manager's lifetime
+    //safe to call from several threads at once, as long as none of them makes structural changes
+    template <typename... Components>
+    View<Components...>& GetView();
+
 private:
-    int nextEntityID = 0;
+    struct RemovedRecord {
+        Entity id;
+        Tick tick;
+    };
+
+    //lets views hear about new archetypes without knowing their component types up front
+    struct ViewBase {
+        virtual ~ViewBase() = default;
+        virtual void OnArchetypeCreated(Archetype& archetype) = 0;
+    };
+
+    //where an entity's row lives
+    struct EntityLocation {
+        Archetype* archetype = nullptr;     //nullptr while the index is free
+        ArchetypeRow slot;
+        std::uint32_t generation = 0;       //current generation of this index
+        std::uint32_t nextFree = NullEntity;    //next index in the free list
+        bool reserved = false;      //handed out by ReserveEntity() but not created yet
+    };
 
-    //type -> (entity -> component pointer)
-    std::unordered_map<std::type_index, std::unordered_map<Entity, void*>> components;
+    std::vector<EntityLocation> locations;  //sparse table indexed by IndexOf(entity)
 
-    //gets hash identifier for components for lookup
+    //FIFO free list threaded through `locations`, so a freed index waits as long as possible before reuse
+    std::uint32_t freeHead = NullEntity;
+    std::uint32_t freeTail = NullEntity;
+
+    ChunkAllocator chunkAllocator;  //declared before archetypes so it outlives them
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::map<std::vector<ComponentId>, Archetype*> archetypeLookup;    //sorted component IDs -> archetype
+    Archetype* emptyArchetype = nullptr;    //entities with no components
+    std::vector<std::unique_ptr<ViewBase>> views;  //cached views, indexed by ViewId<Components...>()
+    std::mutex viewMutex;   //systems running in parallel may create views at the same time
+    momoengine::JobSystem* jobs = nullptr;  //owned by Engine
+
+    std::atomic<Tick> currentTick{ 1 };   //0 means "before anything happened"
+    Tick frameStartTick = 1;
+    std::vector<std::vector<RemovedRecord>> removed;   //removals, indexed by ComponentId
+
+    Entity AllocateHandle();    //takes an index off the free list (or grows the table); NullEntity when full
+    void FreeIndex(std::uint32_t index);    //retires the index's handle and queues it for reuse
+    Archetype* FindOrCreateArchetype(std::vector<const ComponentInfo*> componentTypes);
+    Archetype* ArchetypeWith(Archetype* from, const ComponentInfo* added);
+    Archetype* ArchetypeWithout(Archetype* from, ComponentId removed);
+    void MoveEntity(Entity id, Archetype* to);  //moves shared components; new columns are left uninitialized
+    void* FindComponent(Entity id, ComponentId type, bool markChanged = false);
+    void RecordRemoved(Entity id, ComponentId type);
+
+    //dense component ID for lookups; const is ignored
     template <typename T>
-    static std::type_index Type() { return std::type_index(typeid(T)); }
+    static ComponentId Id() { return ComponentIdOf<T>(); }
+
+    //dense number per View type, so cached views sit in a flat array
+    static std::uint32_t NextViewId();
+    template <typename ViewType>
+    static std::uint32_t ViewId() {
+        static const std::uint32_t id = NextViewId();
+        return id;
+    }
 };
 
 //gets component for entity
 template <typename T>
 T& EntityManager::GetComponent(Entity id) {
-	auto typeIndex = Type<T>();
-	auto componentMapIterator = components.find(typeIndex);		//look for the component with typeIndex
+	void* component = FindComponent(id, Id<T>(), true);
 
-	if (componentMapIterator == components.end()) {
-		spdlog::error("Component type not registered in EntityManager");
+	if (!component) {
+		if (!IsAlive(id)) {
+			spdlog::error("GetComponent called with a dead or stale entity {}", id);
+		}
+		spdlog::error("Requested component not found for this entity.");
 		static T ret{};	//return value; never meant to be written to
 		return ret;		//exits the function
 	}
 
-	auto& entityTable = componentMapIterator->second;	//reference the entity which has the components of typeIndex
-	auto componentIterator = entityTable.find(id);
+	return *static_cast<T*>(component);
+}
 
-	if (componentIterator == entityTable.end()) {
-		spdlog::error("Requested component not found for this entity.");
-		static T ret{};	//return value; never meant to be written to
-		return ret;		//exits the function
+template <typename T>
+const T& EntityManager::ReadComponent(Entity id) {
+	void* component = FindComponent(id, Id<T>());
+
+	if (!component) {
+		spdlog::error("Requested component not found for entity {}.", id);
+		static const T ret{};
+		return ret;
 	}
 
-	return *static_cast<T*>(componentIterator->second);
+	return *static_cast<const T*>(component);
+}
+
+template <typename T>
+void EntityManager::MarkChanged(Entity id) {
+	FindComponent(id, Id<T>(), true);
 }
 
 //stores a copy of component T for the entity
 template <typename T>
 void EntityManager::AddComponent(Entity id, const T& c) {
-	auto& table = components[Type<T>()];
-	table[id] = new T(c);
+	EmplaceComponent<T>(id, c);
+}
+
+template <typename T> requires (!std::is_lvalue_reference_v<T>)
+void EntityManager::AddComponent(Entity id, T&& c) {
+	EmplaceComponent<T>(id, std::move(c));
+}
+
+template <typename T, typename... Args>
+T& EntityManager::EmplaceComponent(Entity id, Args&&... args) {
+	if (!IsAlive(id)) {
+		spdlog::error("AddComponent called on dead or stale entity {}", id);
+		static T ret{};	//return value; never meant to be written to
+		return ret;
+	}
+
+	//already has one: overwrite it in place
+	if (void* existing = FindComponent(id, Id<T>(), true)) {
+		T& component = *static_cast<T*>(existing);
+		component = T(std::forward<Args>(args)...);
+		return component;
+	}
+
+	EntityLocation& location = locations[IndexOf(id)];
+	Archetype* target = ArchetypeWith(location.archetype, ComponentInfo::Get<T>());
+	MoveEntity(id, target);		//the new column is stamped as added at the current tick
+	return *new (target->At(location.slot, target->ColumnOf(Id<T>()))) T(std::forward<Args>(args)...);
 }
 
 //removes component for entity
 template <typename T>
 void EntityManager::RemoveComponent(Entity id) {
-	std::type_index typeIndex = Type<T>();
-	auto componentMapIt = components.find(typeIndex);
+	RemoveRuntimeComponent(id, *ComponentInfo::Get<T>());
+}
 
-	if (componentMapIt != components.end()) {
-		auto& entityTable = componentMapIt->second;
-		auto componentIt = entityTable.find(id);
+//ForEach helper function
+template <typename... Components, typename Func>
+void EntityManager::ForEach(Func func) {
+	GetView<Components...>().ForEach(func);
+}
 
-		if (componentIt != entityTable.end()) {
-			delete static_cast<T*>(componentIt->second);
-			entityTable.erase(componentIt);
+template <typename... Components, typename Filter, typename Func>
+void EntityManager::ForEach(Filter filter, Func func) {
+	GetView<Components...>().ForEach(filter, func);
+}
+
+template <typename... Components, typename Func>
+void EntityManager::ParallelForEach(Func func) {
+	if (!jobs) {
+		ForEach<Components...>(func);
+		return;
+	}
+	GetView<Components...>().ParallelForEach(*jobs, func);
+}
+
+template <typename T, typename Func>
+void EntityManager::ForEachRemoved(Tick since, Func func) {
+	ComponentId type = Id<T>();
+	if (type >= removed.size()) return;
+
+	for (const RemovedRecord& record : removed[type]) {
+		if (record.tick > since) func(record.id);
+	}
+}
+
+//caches the archetypes that contain all of Components along with each one's column indices
+//new archetypes are matched once when they are created, so iterating never hashes
+template <typename... Components>
+class EntityManager::View : public EntityManager::ViewBase {
+public:
+	//calls func(entity, components...) for every matching entity; func must not make structural changes
+	template <typename Func>
+	void ForEach(Func func);
+
+	//only visits entities passing a Changed<T>/Added<T> filter; T must be one of Components
+	template <typename Filter, typename Func>
+	void ForEach(Filter filter, Func func);
+
+	//splits the matching chunks across the job system (see EntityManager::ParallelForEach for the rules)
+	template <typename Func>
+	void ParallelForEach(momoengine::JobSystem& jobs, Func func);
+
+	//calls func(count, entities, arrays...) once per chunk, for code that loops over whole columns itself
+	//the pointers are only good until the next structural change; non-const columns are stamped as changed
+	template <typename Func>
+	void ForEachChunk(Func func);
+
+	//same, but nothing is stamped for the caller: func(count, entities, markChanged, arrays...) calls markChanged(first, count)
+	//for the rows it actually wrote, which stamps just those rows of the non-const columns
+	template <typename Func>
+	void ForEachChunkMarking(Func func);
+
+	//number of entities currently matching
+	std::size_t Size() const {
+		std::size_t total = 0;
+		for (const Match& match : matches) total += match.archetype->Size();
+		return total;
+	}
+
+private:
+	friend class EntityManager;
+
+	explicit View(const std::atomic<Tick>* tick) : tick(tick) {}
+
+	struct Match {
+		Archetype* archetype;
+		std::array<int, sizeof...(Components)> columns;	//column of each requested type
+	};
+	std::vector<Match> matches;
+	const std::atomic<Tick>* tick;	//the manager's current tick, stamped on non-const components we hand out
+
+	struct ChunkRef {
+		const Match* match;
+		Chunk* chunk;
+	};
+
+	void OnArchetypeCreated(Archetype& archetype) override {
+		Match match{ &archetype, { archetype.ColumnOf(Id<Components>())... } };
+		for (int column : match.columns) {
+			if (column < 0) return;
+		}
+		matches.push_back(match);
+	}
+
+	//position of T in Components, ignoring const
+	template <typename T>
+	static constexpr std::size_t ComponentIndex() {
+		constexpr bool same[] = { std::is_same_v<std::remove_const_t<Components>, T>... };
+		for (std::size_t i = 0; i < sizeof...(Components); ++i) {
+			if (same[i]) return i;
 		}
+		return sizeof...(Components);
 	}
+
+	template <typename Func, std::size_t... I>
+	void ForEachInChunk(const Match& match, Chunk& chunk, Func& func, std::index_sequence<I...>);
+
+	template <typename Filter, typename Func, std::size_t... I>
+	void ForEachInChunk(const Match& match, Chunk& chunk, const Filter& filter, Func& func, std::index_sequence<I...>);
+
+	template <typename Func, std::size_t... I>
+	void VisitChunk(const Match& match, Chunk& chunk, Func& func, std::index_sequence<I...>);
+
+	template <typename Func, std::size_t... I>
+	void VisitChunkMarking(const Match& match, Chunk& chunk, Func& func, std::index_sequence<I...>);
+};
+
+template <typename... Components>
+EntityManager::View<Components...>& EntityManager::GetView() {
+	std::lock_guard<std::mutex> lock(viewMutex);
+	std::uint32_t viewId = ViewId<View<Components...>>();
+	if (viewId < views.size() && views[viewId]) return static_cast<View<Components...>&>(*views[viewId]);
+
+	std::unique_ptr<View<Components...>> view(new View<Components...>(&currentTick));
+	for (auto& archetype : archetypes) {
+		view->OnArchetypeCreated(*archetype);
+	}
+
+	View<Components...>& result = *view;
+	if (viewId >= views.size()) views.resize(viewId + 1);
+	views[viewId] = std::move(view);
+	return result;
 }
 
-//ForEach helper function
-template <typename... Components, typename Func>
-void EntityManager::ForEach(Func func) {
-	auto& firstTable = components[Type<std::tuple_element_t<0, std::tuple<Components...>>>()];	//gets the table for the first component type
+template <typename... Components>
+template <typename Func>
+void EntityManager::View<Components...>::ForEach(Func func) {
+	//no structural changes inside func: ForEachInChunk keeps a reference into `matches` and the chunk's rows across the call
+	for (std::size_t m = 0; m < matches.size(); ++m) {
+		Archetype& archetype = *matches[m].archetype;
+		for (std::size_t c = 0; c < archetype.ChunkCount(); ++c) {
+			ForEachInChunk(matches[m], archetype.GetChunk(c), func, std::index_sequence_for<Components...>{});
+		}
+	}
+}
 
-	for (auto& [entity, firstComponentPtr] : firstTable) {
-		bool hasAll = true;
+template <typename... Components>
+template <typename Filter, typename Func>
+void EntityManager::View<Components...>::ForEach(Filter filter, Func func) {
+	constexpr std::size_t filtered = ComponentIndex<typename Filter::Component>();
+	static_assert(filtered < sizeof...(Components), "the filtered component must be part of the view");
 
-		((hasAll = hasAll && components[Type<Components>()].count(entity) > 0), ...);	//check if the entity has all requested components
+	for (std::size_t m = 0; m < matches.size(); ++m) {
+		Archetype& archetype = *matches[m].archetype;
+		int column = matches[m].columns[filtered];
+		for (std::size_t c = 0; c < archetype.ChunkCount(); ++c) {
+			Chunk& chunk = archetype.GetChunk(c);
+			if (archetype.ChunkChangedTick(chunk, column) <= filter.since) continue;	//nothing new in this chunk
+			ForEachInChunk(matches[m], chunk, filter, func, std::index_sequence_for<Components...>{});
+		}
+	}
+}
+
+template <typename... Components>
+template <typename Func>
+void EntityManager::View<Components...>::ParallelForEach(momoengine::JobSystem& jobs, Func func) {
+	//local so two systems can run the same view in parallel
+	std::vector<ChunkRef> chunkList;
+	for (const Match& match : matches) {
+		for (std::size_t c = 0; c < match.archetype->ChunkCount(); ++c) {
+			chunkList.push_back({ &match, &match.archetype->GetChunk(c) });
+		}
+	}
 
-		if (hasAll) {
-			func(entity, GetComponent<Components>(entity)...);
+	//one chunk per task; chunks are big enough to amortize the scheduling
+	jobs.ParallelFor(chunkList.size(), 1, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; ++i) {
+			ForEachInChunk(*chunkList[i].match, *chunkList[i].chunk, func, std::index_sequence_for<Components...>{});
 		}
+	});
+}
+
+template <typename... Components>
+template <typename Func>
+void EntityManager::View<Components...>::ForEachChunk(Func func) {
+	for (std::size_t m = 0; m < matches.size(); ++m) {
+		Archetype& archetype = *matches[m].archetype;
+		for (std::size_t c = 0; c < archetype.ChunkCount(); ++c) {
+			VisitChunk(matches[m], archetype.GetChunk(c), func, std::index_sequence_for<Components...>{});
+		}
+	}
+}
+
+template <typename... Components>
+template <typename Func>
+void EntityManager::View<Components...>::ForEachChunkMarking(Func func) {
+	for (std::size_t m = 0; m < matches.size(); ++m) {
+		Archetype& archetype = *matches[m].archetype;
+		for (std::size_t c = 0; c < archetype.ChunkCount(); ++c) {
+			VisitChunkMarking(matches[m], archetype.GetChunk(c), func, std::index_sequence_for<Components...>{});
+		}
+	}
+}
+
+template <typename... Components>
+template <typename Func, std::size_t... I>
+void EntityManager::View<Components...>::VisitChunkMarking(const Match& match, Chunk& chunk, Func& func, std::index_sequence<I...>) {
+	Archetype& archetype = *match.archetype;
+	if (chunk.count == 0) return;
+
+	Tick now = tick->load(std::memory_order_relaxed);
+	auto markChanged = [&](std::size_t first, std::size_t count) {
+		auto stamp = [&](int column) {
+			std::fill_n(archetype.ChangedTicks(chunk, column) + first, count, now);
+			archetype.ChunkChangedTick(chunk, column) = now;
+		};
+		((std::is_const_v<Components> ? void() : stamp(match.columns[I])), ...);
+	};
+	func(chunk.count, archetype.Entities(chunk), markChanged, archetype.template Column<Components>(chunk, match.columns[I])...);
+}
+
+template <typename... Components>
+template <typename Func, std::size_t... I>
+void EntityManager::View<Components...>::VisitChunk(const Match& match, Chunk& chunk, Func& func, std::index_sequence<I...>) {
+	Archetype& archetype = *match.archetype;
+	if (chunk.count == 0) return;
+	func(chunk.count, archetype.Entities(chunk), archetype.template Column<Components>(chunk, match.columns[I])...);
+
+	Tick now = tick->load(std::memory_order_relaxed);
+	auto stamp = [&](int column) {
+		std::fill_n(archetype.ChangedTicks(chunk, column), chunk.count, now);
+		archetype.ChunkChangedTick(chunk, column) = now;
+	};
+	((std::is_const_v<Components> ? void() : stamp(match.columns[I])), ...);
+}
+
+//walks one chunk's columns linearly, then stamps the non-const columns as changed
+template <typename... Components>
+template <typename Func, std::size_t... I>
+void EntityManager::View<Components...>::ForEachInChunk(const Match& match, Chunk& chunk, Func& func, std::index_sequence<I...>) {
+	Archetype& archetype = *match.archetype;
+	Entity* entities = archetype.Entities(chunk);
+	std::tuple<Components*...> arrays{ archetype.template Column<Components>(chunk, match.columns[I])... };
+
+	for (std::size_t row = 0; row < chunk.count; ++row) {
+		func(entities[row], std::get<I>(arrays)[row]...);
 	}
-}
\ No newline at end of file
+
+	Tick now = tick->load(std::memory_order_relaxed);
+	auto stamp = [&](int column) {
+		std::fill_n(archetype.ChangedTicks(chunk, column), chunk.count, now);
+		archetype.ChunkChangedTick(chunk, column) = now;
+	};
+	((std::is_const_v<Components> ? void() : stamp(match.columns[I])), ...);
+}
+
+//filtered version: checks the filter's tick per row and stamps only the rows it visits
+template <typename... Components>
+template <typename Filter, typename Func, std::size_t... I>
+void EntityManager::View<Components...>::ForEachInChunk(const Match& match, Chunk& chunk, const Filter& filter, Func& func, std::index_sequence<I...>) {
+	Archetype& archetype = *match.archetype;
+	int column = match.columns[ComponentIndex<typename Filter::Component>()];
+	const Tick* ticks = Filter::AddedOnly ? archetype.AddedTicks(chunk, column) : archetype.ChangedTicks(chunk, column);
+	Entity* entities = archetype.Entities(chunk);
+	std::tuple<Components*...> arrays{ archetype.template Column<Components>(chunk, match.columns[I])... };
+
+	Tick now = tick->load(std::memory_order_relaxed);
+	auto stamp = [&](int stampColumn, std::size_t row) {
+		archetype.ChangedTicks(chunk, stampColumn)[row] = now;
+		archetype.ChunkChangedTick(chunk, stampColumn) = now;
+	};
+
+	for (std::size_t row = 0; row < chunk.count; ++row) {
+		if (ticks[row] <= filter.since) continue;
+
+		func(entities[row], std::get<I>(arrays)[row]...);
+		((std::is_const_v<Components> ? void() : stamp(match.columns[I], row)), ...);
+	}
+}
@@ -0,0 +1,76 @@
+#include "FramePacer.h"
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace momoengine {
+
+    double FramePacer::Now() {
+        using namespace std::chrono;
+        return duration<double>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    void FramePacer::Start() {
+        nextTick = Now();
+        lastFrame = nextTick;
+        frames = 0;
+        droppedTicks = 0;
+    }
+
+    int FramePacer::TicksDue() {
+        double now = Now();
+        if (now < nextTick) return 0;
+
+        std::int64_t due = std::int64_t((now - nextTick) / tickInterval) + 1;
+        if (due > maxTicksPerFrame) {
+            //skip the backlog; the simulation runs slow for a moment instead of freezing the frame
+            nextTick += double(due - maxTicksPerFrame) * tickInterval;
+            droppedTicks += std::uint64_t(due - maxTicksPerFrame);
+            due = maxTicksPerFrame;
+        }
+        return (int)due;
+    }
+
+    void FramePacer::WaitUntil(double deadline) const {
+        double remaining = deadline - Now();
+        if (remaining > spinTime) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(remaining - spinTime));
+        }
+        while (Now() < deadline) {
+            std::this_thread::yield();
+        }
+    }
+
+    void FramePacer::RecordFrame() {
+        double now = Now();
+        frameTimes[frames % FrameHistory] = now - lastFrame;
+        lastFrame = now;
+        ++frames;
+    }
+
+    FramePacer::FrameTimes FramePacer::GetFrameTimes() const {
+        FrameTimes times;
+        times.frames = frames;
+        times.droppedTicks = droppedTicks;
+
+        std::size_t count = (std::size_t)std::min<std::uint64_t>(frames, FrameHistory);
+        if (count == 0) return times;
+
+        auto first = frameTimes.begin(), last = frameTimes.begin() + count;
+        double total = 0.0;
+        for (auto it = first; it != last; ++it) total += *it;
+        times.average = total / double(count) * 1000.0;
+        times.best = *std::min_element(first, last) * 1000.0;
+        times.worst = *std::max_element(first, last) * 1000.0;
+        return times;
+    }
+
+    void FramePacer::LogFrameTimes() const {
+        FrameTimes times = GetFrameTimes();
+        spdlog::debug("Frames took {:.3f} ms on average ({:.3f} best, {:.3f} worst); {} ticks dropped so far",
+            times.average, times.best, times.worst, times.droppedTicks);
+    }
+
+}
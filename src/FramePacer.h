@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace momoengine {
+
+    //decides when fixed-step ticks run and waits between them without burning a core
+    //waits sleep most of the way and spin only the last stretch, since sleeps can wake a millisecond or more late
+    //after a stall at most maxTicksPerFrame ticks catch up; the rest of the backlog is dropped rather than spiralling
+    class FramePacer {
+    public:
+        static double Now();    //seconds on a steady clock
+
+        //settings; change them before the loop starts
+        void SetTickRate(double ticksPerSecond) { tickInterval = 1.0 / ticksPerSecond; }
+        double TickInterval() const { return tickInterval; }
+        void SetMaxTicksPerFrame(int ticks) { maxTicksPerFrame = ticks; }
+        void SetSpinTime(double seconds) { spinTime = seconds; }   //0 sleeps all the way, at the cost of waking late
+
+        void Start();       //the first tick is due now
+        int TicksDue();     //how many ticks to run now, at most maxTicksPerFrame
+        double TickTime() const { return nextTick; }    //when the next tick to run was due
+        void EndTick() { nextTick += tickInterval; }    //after running each tick
+        void WaitForTick() const { WaitUntil(nextTick); }
+        void WaitUntil(double deadline) const;
+
+        //frame times over the last FrameHistory frames, in milliseconds
+        struct FrameTimes {
+            double average = 0.0;
+            double best = 0.0;
+            double worst = 0.0;
+            std::uint64_t frames = 0;       //since Start()
+            std::uint64_t droppedTicks = 0; //since Start()
+        };
+        void RecordFrame();     //once per presented frame, from the thread that renders
+        FrameTimes GetFrameTimes() const;
+        void LogFrameTimes() const;
+
+    private:
+        static constexpr std::size_t FrameHistory = 120;
+
+        double tickInterval = 1.0 / 60.0;
+        int maxTicksPerFrame = 5;
+        double spinTime = 0.002;
+
+        double nextTick = 0.0;
+        std::atomic<std::uint64_t> droppedTicks{ 0 };   //the ticking and rendering threads may differ
+
+        std::array<double, FrameHistory> frameTimes{};
+        std::uint64_t frames = 0;
+        double lastFrame = 0.0;
+    };
+
+}
@@ -5,12 +5,17 @@
 #include "GraphicsManager.h"
 #include "EntityManager.h"
 #include "Types.h"
+#include "FramePacer.h"     //for its clock
 #include "spdlog/spdlog.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
 
 #include <algorithm> //for using std::sort
+#include <array>
+#include <cstring>
 #include <iostream>
 
 
@@ -18,15 +23,6 @@
 template< typename T > constexpr const T* to_ptr(const T& val) { return &val; }
 template< typename T, std::size_t N > constexpr const T* to_ptr(const T(&& arr)[N]) { return arr; }
 
-//replacement function for wgpuSurfaceGetPreferredFormat()
-WGPUTextureFormat wgpuSurfaceGetPreferredFormat(WGPUSurface surface, WGPUAdapter adapter) {
-    WGPUSurfaceCapabilities capabilities{};
-    wgpuSurfaceGetCapabilities(surface, adapter, &capabilities);
-    const WGPUTextureFormat result = capabilities.formats[0];
-    wgpuSurfaceCapabilitiesFreeMembers(capabilities);
-    return result;
-}
-
 namespace {
     // A vertex buffer containing a textured square.
     const struct {
@@ -40,20 +36,111 @@ namespace {
         {  1.0f,  1.0f, 1.0f, 0.0f },  // top-right
     };
 
-    struct InstanceData {
-        glm::vec3 translation;
-        glm::vec2 scale;
-        // rotation?
-    };
-
     struct Uniforms {
         glm::mat4 projection;
     };
+
+    //WGSL Shaders
+    const char* sprite_shader = R"(
+        struct Uniforms {
+            projection: mat4x4f,
+        };
+
+        @group(0) @binding(0) var<uniform> uniforms: Uniforms;
+        @group(0) @binding(1) var texSampler: sampler;
+        @group(0) @binding(2) var texData: texture_2d<f32>;
+
+        struct VertexInput {
+            @location(0) position: vec2f,
+            @location(1) texcoords: vec2f,
+            @location(2) translation: vec3f,
+            @location(3) scale: vec2f,
+            @location(4) uvRect: vec4f,
+        };
+
+        struct VertexOutput {
+            @builtin(position) position: vec4f,
+            @location(0) texcoords: vec2f,
+        };
+
+        @vertex
+        fn vertex_shader_main( in: VertexInput ) -> VertexOutput {
+            var out: VertexOutput;
+            out.position = uniforms.projection * vec4f( vec3f( in.scale * in.position, 0.0 ) + in.translation, 1.0 );
+            out.texcoords = in.uvRect.xy + in.texcoords * in.uvRect.zw;
+            return out;
+        }
+
+        @fragment
+        fn fragment_shader_main( in: VertexOutput ) -> @location(0) vec4f {
+            let color = textureSample( texData, texSampler, in.texcoords ).rgba;
+            return color;
+        }
+    )";
+
+    //clip-space units per world unit for a camera, squashing the longer axis so sprites keep their shape
+    glm::vec2 ViewScale(const Camera& camera, int width, int height) {
+        glm::vec2 scale(camera.zoom);
+        if (width < height) {
+            scale.y *= static_cast<float>(width) / static_cast<float>(height);
+        }
+        else {
+            scale.x *= static_cast<float>(height) / static_cast<float>(width);
+        }
+        return scale;
+    }
+
+    //stable LSD radix sort on Entry::key, one byte per pass; passes where every key has the same byte are skipped
+    template <typename Entry>
+    void RadixSort(std::vector<Entry>& entries, std::vector<Entry>& scratch) {
+        constexpr int Passes = sizeof(std::uint64_t);
+
+        //all eight histograms in one read of the keys
+        std::uint32_t counts[Passes][256] = {};
+        for (const Entry& entry : entries) {
+            for (int pass = 0; pass < Passes; ++pass) {
+                ++counts[pass][(entry.key >> (pass * 8)) & 0xFF];
+            }
+        }
+
+        scratch.resize(entries.size());
+        for (int pass = 0; pass < Passes; ++pass) {
+            std::uint32_t* count = counts[pass];
+            if (count[(entries.empty() ? 0 : entries[0].key >> (pass * 8)) & 0xFF] == entries.size()) continue;
+
+            std::uint32_t offset = 0;
+            for (int digit = 0; digit < 256; ++digit) {
+                std::uint32_t n = count[digit];
+                count[digit] = offset;
+                offset += n;
+            }
+            for (const Entry& entry : entries) {
+                scratch[count[(entry.key >> (pass * 8)) & 0xFF]++] = entry;
+            }
+            entries.swap(scratch);
+        }
+    }
+
+    //cheap when the entries are already almost in order
+    template <typename Entry>
+    void InsertionSort(std::vector<Entry>& entries) {
+        for (std::size_t i = 1; i < entries.size(); ++i) {
+            Entry entry = entries[i];
+            std::size_t j = i;
+            for (; j > 0 && entries[j - 1].key > entry.key; --j) {
+                entries[j] = entries[j - 1];
+            }
+            entries[j] = entry;
+        }
+    }
 }
 
 namespace momoengine {
 
     bool GraphicsManager::Startup(int window_width, int window_height, const char* window_name, bool fullscreen) {
+        startupTimings.clear();
+        stageStart = FramePacer::Now();
+
         if (!glfwInit()) {
             spdlog::error("Failed to initialize GLFW.");
             return false;
@@ -71,6 +158,7 @@ namespace momoengine {
 
         glfwSetWindowAspectRatio(window, window_width, window_height);
         spdlog::info("Window created: {}x{}", window_width, window_height);
+        EndStage("window");
 
         // WebGPU Initializations
         //create instance
@@ -84,29 +172,129 @@ namespace momoengine {
 
         surface = glfwCreateWindowWGPUSurface(instance, window);
 
-        adapter = nullptr;
+        if (!StartupDevice(WGPURequestAdapterOptions{ .featureLevel = WGPUFeatureLevel_Core, .compatibleSurface = surface })) {
+            glfwTerminate();
+            return false;
+        }
+
+        //surface configuration; one capabilities query covers the format and the present modes
+        WGPUSurfaceCapabilities capabilities{};
+        wgpuSurfaceGetCapabilities(surface, adapter, &capabilities);
+        color_format = capabilities.formats[0];
+        present_modes.assign(capabilities.presentModes, capabilities.presentModes + capabilities.presentModeCount);
+        wgpuSurfaceCapabilitiesFreeMembers(capabilities);
+        ConfigureSurface();
+        EndStage("surface");
+
+        return StartupResources();
+    }
+
+    void GraphicsManager::SetPresentMode(PresentMode mode) {
+        present_mode = mode;
+        if (surface) ConfigureSurface();
+    }
+
+    void GraphicsManager::ConfigureSurface() {
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+
+        WGPUPresentMode mode = WGPUPresentMode_Fifo;
+        if (present_mode == PresentMode::Mailbox) mode = WGPUPresentMode_Mailbox;
+        if (present_mode == PresentMode::Immediate) mode = WGPUPresentMode_Immediate;
+
+        //Fifo is the only mode every surface has
+        if (std::find(present_modes.begin(), present_modes.end(), mode) == present_modes.end()) {
+            spdlog::warn("Present mode {} isn't supported here; using Fifo.", (int)present_mode);
+            mode = WGPUPresentMode_Fifo;
+        }
+
+        wgpuSurfaceConfigure(surface, to_ptr(WGPUSurfaceConfiguration{
+            .device = device,
+            .format = color_format,
+            .usage = WGPUTextureUsage_RenderAttachment,
+            .width = (uint32_t)width,
+            .height = (uint32_t)height,
+            .presentMode = mode // Explicitly set this because of a Dawn bug
+            }));
+        viewWidth = width;
+        viewHeight = height;
+    }
+
+    bool GraphicsManager::StartupHeadless(int width, int height, HeadlessBackend backend) {
+        startupTimings.clear();
+        stageStart = FramePacer::Now();
+
+        instance = wgpuCreateInstance(to_ptr(WGPUInstanceDescriptor{}));
+        if (!instance) {
+            spdlog::error("Failed to create WebGPU instance.");
+            return false;
+        }
+
+        //no surface to be compatible with; the fallback adapter is Dawn's CPU renderer (SwiftShader)
+        bool ok = StartupDevice(WGPURequestAdapterOptions{
+            .featureLevel = WGPUFeatureLevel_Core,
+            .forceFallbackAdapter = backend == HeadlessBackend::Software,
+            .backendType = backend == HeadlessBackend::Null ? WGPUBackendType_Null : WGPUBackendType_Undefined
+            });
+        if (!ok) return false;
+
+        //frames go into a texture that SaveFrame() can copy back
+        color_format = WGPUTextureFormat_RGBA8Unorm;
+        offscreen_width = width;
+        offscreen_height = height;
+        viewWidth = width;
+        viewHeight = height;
+        offscreen_texture = wgpuDeviceCreateTexture(device, to_ptr(WGPUTextureDescriptor{
+            .label = WGPUStringView("Offscreen Target", WGPU_STRLEN),
+            .usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_CopySrc,
+            .dimension = WGPUTextureDimension_2D,
+            .size = { (uint32_t)width, (uint32_t)height, 1 },
+            .format = color_format,
+            .mipLevelCount = 1,
+            .sampleCount = 1
+        }));
+        offscreen_view = wgpuTextureCreateView(offscreen_texture, nullptr);
+        spdlog::info("Headless rendering into a {}x{} offscreen texture.", width, height);
+        EndStage("offscreen target");
+
+        return StartupResources();
+    }
+
+    //gets the adapter, device and queue; waits on the callbacks instead of assuming they succeed
+    bool GraphicsManager::StartupDevice(const WGPURequestAdapterOptions& options) {
+        struct AdapterRequest {
+            WGPUAdapter adapter = nullptr;
+            bool done = false;
+        } adapter_request;
         wgpuInstanceRequestAdapter(
             instance,
-            to_ptr(WGPURequestAdapterOptions{ .featureLevel = WGPUFeatureLevel_Core, .compatibleSurface = surface }),
+            &options,
             WGPURequestAdapterCallbackInfo{
                 .mode = WGPUCallbackMode_AllowSpontaneous,
-                .callback = [](WGPURequestAdapterStatus status, WGPUAdapter adapter, WGPUStringView message, void* adapter_ptr, void*) {
+                .callback = [](WGPURequestAdapterStatus status, WGPUAdapter adapter, WGPUStringView message, void* request_ptr, void*) {
                     if (status != WGPURequestAdapterStatus_Success) {
                         std::cerr << "Failed to get a WebGPU adapter: " << std::string_view(message.data, message.length) << std::endl;
-                        glfwTerminate();
                     }
 
-                    *static_cast<WGPUAdapter*>(adapter_ptr) = adapter;
+                    auto* request = static_cast<AdapterRequest*>(request_ptr);
+                    request->adapter = adapter;
+                    request->done = true;
                 },
-                .userdata1 = &(adapter)
+                .userdata1 = &adapter_request
             }
         );
-        while (!adapter) wgpuInstanceProcessEvents(instance);
-        assert(adapter);
-
+        while (!adapter_request.done) wgpuInstanceProcessEvents(instance);
+        adapter = adapter_request.adapter;
+        if (!adapter) return false;
+
+        struct DeviceRequest {
+            WGPUDevice device = nullptr;
+            bool done = false;
+        } device_request;
         wgpuAdapterRequestDevice(
             adapter,
             to_ptr(WGPUDeviceDescriptor{
+                .nextInChain = pipelines.DeviceExtension(adapter),     //the on-disk shader cache
                 // Add an error callback for more debug info
                 .uncapturedErrorCallbackInfo = {.callback = [](WGPUDevice const* device, WGPUErrorType type, WGPUStringView message, void*, void*) {
                     std::cerr << "WebGPU uncaptured error type " << int(type) << " with message: " << std::string_view(message.data, message.length) << std::endl;
@@ -114,34 +302,98 @@ namespace momoengine {
                 }),
             WGPURequestDeviceCallbackInfo{
                 .mode = WGPUCallbackMode_AllowSpontaneous,
-                .callback = [](WGPURequestDeviceStatus status, WGPUDevice device, WGPUStringView message, void* device_ptr, void*) {
+                .callback = [](WGPURequestDeviceStatus status, WGPUDevice device, WGPUStringView message, void* request_ptr, void*) {
                     if (status != WGPURequestDeviceStatus_Success) {
                         std::cerr << "Failed to get a WebGPU device: " << std::string_view(message.data, message.length) << std::endl;
-                        glfwTerminate();
                     }
 
-                    *static_cast<WGPUDevice*>(device_ptr) = device;
+                    auto* request = static_cast<DeviceRequest*>(request_ptr);
+                    request->device = device;
+                    request->done = true;
                 },
-                .userdata1 = &(device)
+                .userdata1 = &device_request
             }
         );
-        while (!device) wgpuInstanceProcessEvents(instance);
-        assert(device);
+        while (!device_request.done) wgpuInstanceProcessEvents(instance);
+        device = device_request.device;
+        if (!device) return false;
 
         queue = wgpuDeviceGetQueue(device);
+        pipelines.Startup(instance, device);
+        EndStage("device");
+        return true;
+    }
 
-        //surface configuration
-        int width, height;
-        glfwGetFramebufferSize(window, &width, &height);
-        wgpuSurfaceConfigure(surface, to_ptr(WGPUSurfaceConfiguration{
-            .device = device,
-            .format = wgpuSurfaceGetPreferredFormat(surface, adapter),
-            .usage = WGPUTextureUsage_RenderAttachment,
-            .width = (uint32_t)width,
-            .height = (uint32_t)height,
-            .presentMode = WGPUPresentMode_Fifo // Explicitly set this because of a Dawn bug
+    //buffers, sampler, shaders and pipeline; the same with or without a window
+    bool GraphicsManager::StartupResources() {
+        //the layout is spelled out rather than taken from the pipeline, so atlas pages can be made while it compiles
+        bind_group_layout = wgpuDeviceCreateBindGroupLayout(device, to_ptr(WGPUBindGroupLayoutDescriptor{
+            .entryCount = 3,
+            .entries = to_ptr<WGPUBindGroupLayoutEntry>({
+                {
+                    .binding = 0,
+                    .visibility = WGPUShaderStage_Vertex,
+                    .buffer = { .type = WGPUBufferBindingType_Uniform, .minBindingSize = sizeof(Uniforms) }
+                },
+                {
+                    .binding = 1,
+                    .visibility = WGPUShaderStage_Fragment,
+                    .sampler = { .type = WGPUSamplerBindingType_Filtering }
+                },
+                {
+                    .binding = 2,
+                    .visibility = WGPUShaderStage_Fragment,
+                    .texture = { .sampleType = WGPUTextureSampleType_Float, .viewDimension = WGPUTextureViewDimension_2D }
+                }
+                })
+            }));
+        pipeline_layout = wgpuDeviceCreatePipelineLayout(device, to_ptr(WGPUPipelineLayoutDescriptor{
+            .bindGroupLayoutCount = 1,
+            .bindGroupLayouts = &bind_group_layout
             }));
 
+        //start compiling the sprite pipeline; the buffers and atlas below are made in the meantime
+        PipelineCache::Description sprite_pipeline{
+            .label = "Sprites",
+            .shader = sprite_shader,
+            .layout = pipeline_layout,
+            .buffers = {
+                // We have one buffer with our per-vertex position and UV data. This data never changes.
+                // Note how the type, byte offset, and stride (bytes between elements) exactly matches our `vertex_buffer`.
+                {
+                    .stepMode = WGPUVertexStepMode_Vertex,
+                    .arrayStride = 4 * sizeof(float),
+                    .attributes = {
+                        // Position x,y are first.
+                        { .format = WGPUVertexFormat_Float32x2, .offset = 0, .shaderLocation = 0 },
+                        // Texture coordinates u,v are second.
+                        { .format = WGPUVertexFormat_Float32x2, .offset = 2 * sizeof(float), .shaderLocation = 1 }
+                    }
+                },
+                // We will use a second buffer with our per-sprite data. Each instance of drawing the vertices gets a different value.
+                // The type, byte offset, and stride (bytes between elements) exactly match the array of `InstanceData` structs we upload.
+                {
+                    .stepMode = WGPUVertexStepMode_Instance,
+                    .arrayStride = sizeof(InstanceData),
+                    .attributes = {
+                        // Translation as a 3D vector.
+                        { .format = WGPUVertexFormat_Float32x3, .offset = offsetof(InstanceData, translation), .shaderLocation = 2 },
+                        // Scale as a 2D vector for non-uniform scaling.
+                        { .format = WGPUVertexFormat_Float32x2, .offset = offsetof(InstanceData, scale), .shaderLocation = 3 },
+                        // Where the sprite's image sits in its atlas page.
+                        { .format = WGPUVertexFormat_Float32x4, .offset = offsetof(InstanceData, uvRect), .shaderLocation = 4 }
+                    }
+                }
+            },
+            // Interpret our 4 vertices as a triangle strip
+            .topology = WGPUPrimitiveTopology_TriangleStrip,
+            .colorFormat = color_format,
+            // The images we want to draw may have transparency, so let's turn on alpha blending with over compositing (ɑ⋅foreground + (1-ɑ)⋅background).
+            .alphaBlend = true
+        };
+        PipelineCache::Handle sprite_handle = pipelines.Request(sprite_pipeline);
+        EndStage("pipeline request");
+
         //vertex buffer
         vertex_buffer = wgpuDeviceCreateBuffer(device, to_ptr(WGPUBufferDescriptor{
             .label = WGPUStringView("Vertex Buffer", WGPU_STRLEN),
@@ -169,154 +421,37 @@ namespace momoengine {
             .maxAnisotropy = 1
         }));
         spdlog::info("Sampler created.");
+        EndStage("buffers");
+
+        //grey checkerboard for sprites whose texture is still loading
+        constexpr int checker_size = 8;
+        unsigned char checker[checker_size * checker_size * 4];
+        for (int i = 0; i < checker_size * checker_size; ++i) {
+            unsigned char shade = (i / checker_size / 4 + i % checker_size / 4) % 2 ? 160 : 96;
+            checker[i * 4 + 0] = checker[i * 4 + 1] = checker[i * 4 + 2] = shade;
+            checker[i * 4 + 3] = 255;
+        }
+        AddToAtlas(checker, checker_size, checker_size, placeholder);
+        EndStage("atlas");
 
-        //WGSL Shaders
-        const char* source = R"(
-            struct Uniforms {
-                projection: mat4x4f,
-            };
-
-            @group(0) @binding(0) var<uniform> uniforms: Uniforms;
-            @group(0) @binding(1) var texSampler: sampler;
-            @group(0) @binding(2) var texData: texture_2d<f32>;
-
-            struct VertexInput {
-                @location(0) position: vec2f,
-                @location(1) texcoords: vec2f,
-                @location(2) translation: vec3f,
-                @location(3) scale: vec2f,
-            };
-
-            struct VertexOutput {
-                @builtin(position) position: vec4f,
-                @location(0) texcoords: vec2f,
-            };
-
-            @vertex
-            fn vertex_shader_main( in: VertexInput ) -> VertexOutput {
-                var out: VertexOutput;
-                out.position = uniforms.projection * vec4f( vec3f( in.scale * in.position, 0.0 ) + in.translation, 1.0 );
-                out.texcoords = in.texcoords;
-                return out;
-            }
-
-            @fragment
-            fn fragment_shader_main( in: VertexOutput ) -> @location(0) vec4f {
-                let color = textureSample( texData, texSampler, in.texcoords ).rgba;
-                return color;
-            }
-        )";
-
-        //create shader module from the source
-        WGPUShaderSourceWGSL source_desc = {};
-        source_desc.chain.sType = WGPUSType_ShaderSourceWGSL;
-        source_desc.code = WGPUStringView(source, std::string_view(source).length());
-        // Point to the code descriptor from the shader descriptor.
-        WGPUShaderModuleDescriptor shader_desc = {};
-        shader_desc.nextInChain = &source_desc.chain;
-        shader_module = wgpuDeviceCreateShaderModule(device, &shader_desc);
-
-        //pipeline
-        pipeline = wgpuDeviceCreateRenderPipeline(device, to_ptr(WGPURenderPipelineDescriptor{
-
-            // Describe the vertex shader inputs
-            .vertex = {
-                .module = shader_module,
-                .entryPoint = WGPUStringView{ "vertex_shader_main", std::string_view("vertex_shader_main").length() },
-                // Vertex attributes.
-                .bufferCount = 2,
-                .buffers = to_ptr<WGPUVertexBufferLayout>({
-                // We have one buffer with our per-vertex position and UV data. This data never changes.
-                // Note how the type, byte offset, and stride (bytes between elements) exactly matches our `vertex_buffer`.
-                {
-                    .stepMode = WGPUVertexStepMode_Vertex,
-                    .arrayStride = 4 * sizeof(float),
-                    .attributeCount = 2,
-                    .attributes = to_ptr<WGPUVertexAttribute>({
-                        // Position x,y are first.
-                        {
-                            .format = WGPUVertexFormat_Float32x2,
-                            .offset = 0,
-                            .shaderLocation = 0
-                        },
-                        // Texture coordinates u,v are second.
-                        {
-                            .format = WGPUVertexFormat_Float32x2,
-                            .offset = 2 * sizeof(float),
-                            .shaderLocation = 1
-                        }
-                        })
-                },
-                    // We will use a second buffer with our per-sprite translation and scale. This data will be set in our draw function.
-                    {
-                        // This data is per-instance. All four vertices will get the same value. Each instance of drawing the vertices will get a different value.
-                        // The type, byte offset, and stride (bytes between elements) exactly match the array of `InstanceData` structs we will upload in our draw function.
-                        .stepMode = WGPUVertexStepMode_Instance,
-                        .arrayStride = sizeof(InstanceData),
-                        .attributeCount = 2,
-                        .attributes = to_ptr<WGPUVertexAttribute>({
-                        // Translation as a 3D vector.
-                        {
-                            .format = WGPUVertexFormat_Float32x3,
-                            .offset = offsetof(InstanceData, translation),
-                            .shaderLocation = 2
-                        },
-                            // Scale as a 2D vector for non-uniform scaling.
-                            {
-                                .format = WGPUVertexFormat_Float32x2,
-                                .offset = offsetof(InstanceData, scale),
-                                .shaderLocation = 3
-                            }
-                            })
-                    }
-                    })
-                },
-
-            // Interpret our 4 vertices as a triangle strip
-            .primitive = WGPUPrimitiveState{
-                .topology = WGPUPrimitiveTopology_TriangleStrip,
-                },
-
-                // No multi-sampling (1 sample per pixel, all bits on).
-                .multisample = WGPUMultisampleState{
-                    .count = 1,
-                    .mask = ~0u
-                    },
-
-            // Describe the fragment shader and its output
-            .fragment = to_ptr(WGPUFragmentState{
-                .module = shader_module,
-                .entryPoint = WGPUStringView{ "fragment_shader_main", std::string_view("fragment_shader_main").length() },
-
-                // Our fragment shader outputs a single color value per pixel.
-                .targetCount = 1,
-                .targets = to_ptr<WGPUColorTargetState>({
-                    {
-                        .format = wgpuSurfaceGetPreferredFormat(surface, adapter),
-                        // The images we want to draw may have transparency, so let's turn on alpha blending with over compositing (ɑ⋅foreground + (1-ɑ)⋅background).
-                        // This will blend with whatever has already been drawn.
-                        .blend = to_ptr(WGPUBlendState{
-                        // Over blending for color
-                        .color = {
-                            .operation = WGPUBlendOperation_Add,
-                            .srcFactor = WGPUBlendFactor_SrcAlpha,
-                            .dstFactor = WGPUBlendFactor_OneMinusSrcAlpha
-                            },
-                            // Leave destination alpha alone
-                            .alpha = {
-                                .operation = WGPUBlendOperation_Add,
-                                .srcFactor = WGPUBlendFactor_Zero,
-                                .dstFactor = WGPUBlendFactor_One
-                                }
-                            }),
-                        .writeMask = WGPUColorWriteMask_All
-                    }})
-                })
-            }));
+        //whatever compiling is left now holds up startup
+        pipeline = pipelines.Wait(sprite_handle);
+        EndStage("pipeline wait");
+        if (!pipeline) return false;
 
+        double total = 0.0;
+        for (const StartupStage& stage : startupTimings) total += stage.milliseconds;
+        spdlog::info("Graphics startup took {:.1f} ms.", total);
         return true;
     }
 
+    void GraphicsManager::EndStage(const char* name) {
+        double now = FramePacer::Now();
+        startupTimings.push_back({ name, (now - stageStart) * 1000.0 });
+        spdlog::debug("  startup stage {:<16} {:.1f} ms", name, startupTimings.back().milliseconds);
+        stageStart = now;
+    }
+
     bool GraphicsManager::LoadTexture(const std::string& name, const std::string& path) {
         //load the image pixels
         int width, height, channels;
@@ -327,37 +462,194 @@ namespace momoengine {
         }
         spdlog::info("Loaded texture '{}' ({}x{}, {} channels)", path, width, height, channels);
 
+        TextureInfo info;
+        bool packed = AddToAtlas(data, width, height, info);
+
+        //free image memory
+        stbi_image_free(data);
+
+        if (packed) {
+            std::lock_guard<std::mutex> lock(textureMutex);
+            textures[name] = info;
+            texturesChanged = true;
+        }
+        return packed;
+    }
+
+    GraphicsManager::TextureHandle GraphicsManager::LoadTextureAsync(const std::string& name, const std::string& path) {
+        TextureHandle handle;
+        {
+            std::lock_guard<std::mutex> lock(textureMutex);
+            handle = (TextureHandle)textureStates.size();
+            textureStates.push_back(TextureState::Loading);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(loadMutex);
+            decodeQueue.push_back({ handle, name, path });
+        }
+
+        //no workers: decode here, but still upload with the per-frame budget
+        if (!jobs) {
+            DecodeNext();
+            return handle;
+        }
+        jobs->Dispatch(1, 1, decodeTask, decodesInFlight);
+        return handle;
+    }
+
+    GraphicsManager::TextureState GraphicsManager::GetTextureState(TextureHandle handle) const {
+        std::lock_guard<std::mutex> lock(textureMutex);
+        if (handle >= textureStates.size()) return TextureState::Failed;    //never handed out by LoadTextureAsync
+        return textureStates[handle];
+    }
+
+    void GraphicsManager::SetJobSystem(JobSystem* jobSystem) {
+        //decodes that are already queued use the old job system
+        if (jobs) jobs->Wait(decodesInFlight);
+        jobs = jobSystem;
+    }
+
+    void GraphicsManager::DecodeNext() {
+        TextureLoad load;
+        {
+            std::lock_guard<std::mutex> lock(loadMutex);
+            load = std::move(decodeQueue.front());     //every queued task has a load of its own
+            decodeQueue.pop_front();
+        }
+
+        int channels;
+        load.pixels = stbi_load(load.path.c_str(), &load.width, &load.height, &channels, 4);
+
+        std::lock_guard<std::mutex> lock(loadMutex);
+        uploadQueue.push_back(std::move(load));
+    }
+
+    void GraphicsManager::UploadTextures() {
+        std::size_t budget = UploadBudgetBytes;
+        while (true) {
+            TextureLoad load;
+            {
+                std::lock_guard<std::mutex> lock(loadMutex);
+                if (uploadQueue.empty()) break;
+
+                //an image bigger than the whole budget still goes through, just on its own
+                std::size_t bytes = (std::size_t)uploadQueue.front().width * uploadQueue.front().height * 4;
+                if (bytes > budget && budget < UploadBudgetBytes) break;
+                load = std::move(uploadQueue.front());
+                uploadQueue.pop_front();
+            }
+
+            if (!load.pixels) {
+                spdlog::error("Failed to load texture: {}", load.path);
+                std::lock_guard<std::mutex> lock(textureMutex);
+                textureStates[load.handle] = TextureState::Failed;
+                continue;
+            }
+
+            std::size_t bytes = (std::size_t)load.width * load.height * 4;
+            budget -= std::min(bytes, budget);
+
+            TextureInfo info;
+            bool packed = AddToAtlas(load.pixels, load.width, load.height, info);
+            stbi_image_free(load.pixels);
+
+            {
+                std::lock_guard<std::mutex> lock(textureMutex);
+                if (packed) {
+                    textures[load.name] = info;
+                    texturesChanged = true;
+                }
+                textureStates[load.handle] = packed ? TextureState::Ready : TextureState::Failed;
+            }
+            ++frameStats.texturesUploaded;
+            frameStats.textureBytesUploaded += bytes;
+            spdlog::info("Loaded texture '{}' ({}x{})", load.path, load.width, load.height);
+        }
+    }
+
+    bool GraphicsManager::AddToAtlas(const unsigned char* pixels, int width, int height, TextureInfo& placed) {
+        int padded_width = width + 2 * AtlasPadding;
+        int padded_height = height + 2 * AtlasPadding;
+
+        //tries the page's current shelf, then a new shelf below it
+        auto place = [&](AtlasPage& page, int& x, int& y) {
+            if (page.shelfX + padded_width <= page.size && page.shelfY + padded_height <= page.size) {
+                x = page.shelfX;
+                y = page.shelfY;
+                return true;
+            }
+            int next_shelf = page.shelfY + page.shelfHeight;
+            if (padded_width <= page.size && next_shelf + padded_height <= page.size) {
+                page.shelfX = 0;
+                page.shelfY = next_shelf;
+                page.shelfHeight = 0;
+                x = 0;
+                y = next_shelf;
+                return true;
+            }
+            return false;
+        };
+
+        int x = 0, y = 0;
+        std::uint32_t page_index = 0;
+        while (page_index < atlasPages.size() && !place(atlasPages[page_index], x, y)) ++page_index;
+
+        //images bigger than a page get a page of their own
+        if (page_index == atlasPages.size()) {
+            place(CreateAtlasPage(std::max({ AtlasPageSize, padded_width, padded_height })), x, y);
+        }
+
+        AtlasPage& page = atlasPages[page_index];
+        page.shelfX = x + padded_width;
+        page.shelfHeight = std::max(page.shelfHeight, padded_height);
+
+        //repeat the edge pixels into the padding
+        std::vector<unsigned char> padded((std::size_t)padded_width * padded_height * 4);
+        for (int py = 0; py < padded_height; ++py) {
+            int sy = std::clamp(py - AtlasPadding, 0, height - 1);
+            for (int px = 0; px < padded_width; ++px) {
+                int sx = std::clamp(px - AtlasPadding, 0, width - 1);
+                std::memcpy(&padded[((std::size_t)py * padded_width + px) * 4], &pixels[((std::size_t)sy * width + sx) * 4], 4);
+            }
+        }
+
+        //upload pixels into the page
+        wgpuQueueWriteTexture(
+            queue,
+            to_ptr<WGPUTexelCopyTextureInfo>({ .texture = page.texture, .origin = { (uint32_t)x, (uint32_t)y, 0 } }),
+            padded.data(),
+            padded.size(),
+            to_ptr<WGPUTexelCopyBufferLayout>({ .bytesPerRow = (uint32_t)(padded_width * 4), .rowsPerImage = (uint32_t)padded_height }),
+            to_ptr(WGPUExtent3D{ (uint32_t)padded_width, (uint32_t)padded_height, 1 })
+        );
+
+        //reloading a name packs it again; the old spot is simply left unused
+        float size = static_cast<float>(page.size);
+        placed = { width, height, page_index,
+            glm::vec4((x + AtlasPadding) / size, (y + AtlasPadding) / size, width / size, height / size) };
+
+        return true;
+    }
+
+    GraphicsManager::AtlasPage& GraphicsManager::CreateAtlasPage(int size) {
         //create the texture
         WGPUTexture tex = wgpuDeviceCreateTexture(device, to_ptr(WGPUTextureDescriptor{
-            .label = WGPUStringView(path.c_str(), WGPU_STRLEN),
+            .label = WGPUStringView("Atlas Page", WGPU_STRLEN),
             .usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst,
             .dimension = WGPUTextureDimension_2D,
-            .size = { (uint32_t)width, (uint32_t)height, 1 },
+            .size = { (uint32_t)size, (uint32_t)size, 1 },
             .format = WGPUTextureFormat_RGBA8UnormSrgb,
             .mipLevelCount = 1,
             .sampleCount = 1
          }));
 
-        //upload pixels
-        wgpuQueueWriteTexture(
-            queue,
-            to_ptr<WGPUTexelCopyTextureInfo>({ .texture = tex }),
-            data,
-            width * height * 4,
-            to_ptr<WGPUTexelCopyBufferLayout>({ .bytesPerRow = (uint32_t)(width * 4), .rowsPerImage = (uint32_t)height }),
-            to_ptr(WGPUExtent3D{ (uint32_t)width, (uint32_t)height, 1 })
-        );
-
-        //free image memory
-        stbi_image_free(data);
-
         //create a single texture view
         WGPUTextureView texView = wgpuTextureCreateView(tex, nullptr);
 
         //create the group of bindings
-        auto layout = wgpuRenderPipelineGetBindGroupLayout(pipeline, 0);
-        bind_group = wgpuDeviceCreateBindGroup(device, to_ptr(WGPUBindGroupDescriptor{
-            .layout = layout,
+        WGPUBindGroup bind_group = wgpuDeviceCreateBindGroup(device, to_ptr(WGPUBindGroupDescriptor{
+            .layout = bind_group_layout,
             .entryCount = 3,
             // The entries `.binding` matches what we wrote in the shader.
             .entries = to_ptr<WGPUBindGroupEntry>({
@@ -376,36 +668,100 @@ namespace momoengine {
                 }
                 })
             }));
-        wgpuBindGroupLayoutRelease(layout);
-
-        textures[name] = { texView, width, height };
 
-        return true;
+        atlasPages.push_back({ tex, texView, bind_group, size, 0, 0, 0 });
+        spdlog::info("Created atlas page {} ({}x{}).", atlasPages.size() - 1, size, size);
+        return atlasPages.back();
     }
 
     //void GraphicsManager::Draw(const std::vector<Sprite>& sprites) { --old version
     void GraphicsManager::Draw(EntityManager& entities) {
         //if (sprites.empty()) return;  --old version
+        Extract(entities, drawSnapshot);
+        Render(drawSnapshot);
+    }
+
+    void GraphicsManager::Extract(EntityManager& entities, RenderSnapshot& snapshot) {
+        FrameStats& stats = snapshot.stats;
+        stats = {};
+        ++extractCount;
+
+        //the first Camera entity decides what's on screen
+        Camera camera;
+        bool has_camera = false;
+        entities.ForEach<const Camera>([&](EntityManager::Entity, const Camera& c) {
+            if (!has_camera) camera = c;
+            has_camera = true;
+        });
+        if (camera.zoom <= 0.0f) camera.zoom = 1.0f;
+        snapshot.camera = camera;
+        snapshot.previousCamera = extractCount > 1 ? lastCamera : camera;
+        lastCamera = camera;
+
+        //bring the CPU-side instance data up to date with what changed since the last extract
+        //the arrays keep their capacity, so they only allocate when the sprite count reaches a new high
+        auto capacities = [&] {
+            return std::array{ instances.capacity(), instanceOwners.capacity(), instanceKeys.capacity(), instanceOfEntity.capacity(),
+                instanceMotion.capacity(), drawOrder.capacity(), sortScratch.capacity(), batches.capacity(),
+                snapshot.instances.capacity(), snapshot.previousTranslations.capacity(), snapshot.batches.capacity() };
+        };
+        auto before = capacities();
+        UpdateInstances(entities);
+
+        //the world-space rectangle on screen, grown by the largest sprite so ones straddling an edge are kept
+        glm::vec2 scale = ViewScale(camera, viewWidth, viewHeight);
+        float half_width = 1.0f / scale.x + maxSpriteExtent;
+        float half_height = 1.0f / scale.y + maxSpriteExtent;
+        SpriteGrid::CellRange range = grid.RangeOf(camera.x - half_width, camera.y - half_height, camera.x + half_width, camera.y + half_height);
+        if (range != visibleCells) {
+            visibleCells = range;
+            orderDirty = true;
+        }
+        BuildBatches(snapshot);
+        auto after = capacities();
+        for (std::size_t i = 0; i < before.size(); ++i) {
+            if (before[i] != after[i]) ++stats.cpuAllocations;
+        }
+        stats.instances = (std::uint32_t)snapshot.instances.size();
+        stats.culledInstances = (std::uint32_t)(instances.size() - snapshot.instances.size());
+        stats.batches = (std::uint32_t)snapshot.batches.size();
+    }
+
+    void GraphicsManager::Render(const RenderSnapshot& snapshot, float alpha) {
+        frameStats = snapshot.stats;
+        pipelines.Poll();   //pipelines requested after startup arrive here
+
+        //bring in textures that finished decoding; the next Extract() moves their sprites off the placeholder
+        UploadTextures();
 
         //create projection matrix
         Uniforms uniforms;
-        int width, height;
-        glfwGetFramebufferSize(window, &width, &height);
+        int width = offscreen_width, height = offscreen_height;
+        if (window) glfwGetFramebufferSize(window, &width, &height);
+        viewWidth = width;
+        viewHeight = height;
+
+        //the camera moves smoothly between ticks along with the sprites
+        Camera camera = snapshot.camera;
+        if (alpha < 1.0f) {
+            camera.x = glm::mix(snapshot.previousCamera.x, camera.x, alpha);
+            camera.y = glm::mix(snapshot.previousCamera.y, camera.y, alpha);
+            camera.zoom = glm::mix(snapshot.previousCamera.zoom, camera.zoom, alpha);
+        }
         
         //start with the original size
         uniforms.projection = glm::mat4(1.0f);
         //testing quad projection
         //uniforms.projection[0][0] = 0.5f;
         //uniforms.projection[1][1] = 0.5f;
-        
-        uniforms.projection[0][0] = uniforms.projection[1][1] = 1.0f;
 
-        if (width < height) {
-            uniforms.projection[1][1] *= static_cast<float>(width) / static_cast<float>(height);
-        }
-        else {
-            uniforms.projection[0][0] *= static_cast<float>(height) / static_cast<float>(width);
-        }
+        glm::vec2 scale = ViewScale(camera, width, height);
+        uniforms.projection[0][0] = scale.x;
+        uniforms.projection[1][1] = scale.y;
+
+        //move the camera's position to the center of the screen
+        uniforms.projection[3][0] = -camera.x * uniforms.projection[0][0];
+        uniforms.projection[3][1] = -camera.y * uniforms.projection[1][1];
 
         wgpuQueueWriteBuffer(queue, uniform_buffer, 0, &uniforms, sizeof(Uniforms));
 
@@ -448,37 +804,39 @@ namespace momoengine {
         //        instances.data(), sizeof(InstanceData) * instances.size());
         //}
 
-        //new version
-        //get instance data from EntityManager
-        std::vector<InstanceData> instances;
-
-        entities.ForEach<Sprite, Position>([&](EntityManager::Entity id, Sprite& sprite, Position& pos) {
-            InstanceData data{};
-            data.translation = glm::vec3(pos.x, pos.y, 0.0f);
-
-            //simple uniform scale
-            data.scale = glm::vec2(0.25f, 0.25f);
-
-            instances.push_back(data);
-            });
-
-        if (instances.empty()) return;
+        //with nothing on screen (e.g. everything culled) the frame is still cleared and presented, just not drawn into
+        std::uint64_t instance_offset = 0;
+        std::uint64_t instance_bytes = sizeof(InstanceData) * snapshot.instances.size();
+        if (instance_bytes > 0) {
+            //sprites are drawn alpha of the way from where they were last tick; at 1 the snapshot goes up as is
+            const InstanceData* upload = snapshot.instances.data();
+            if (alpha < 1.0f) {
+                std::size_t capacity = blendedInstances.capacity();
+                blendedInstances.assign(snapshot.instances.begin(), snapshot.instances.end());
+                for (std::size_t i = 0; i < blendedInstances.size(); ++i) {
+                    blendedInstances[i].translation = glm::mix(snapshot.previousTranslations[i], snapshot.instances[i].translation, alpha);
+                }
+                if (blendedInstances.capacity() != capacity) ++frameStats.cpuAllocations;
+                upload = blendedInstances.data();
+            }
 
-        //upload instance data
-        instance_buffer = wgpuDeviceCreateBuffer(device, to_ptr<WGPUBufferDescriptor>({
-            .label = WGPUStringView("Instance Buffer", WGPU_STRLEN),
-            .usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex,
-            .size = sizeof(InstanceData) * instances.size()
-        }));
-        wgpuQueueWriteBuffer(queue, instance_buffer, 0, instances.data(), sizeof(InstanceData) * instances.size());
+            //upload instance data into this frame's region of the persistent buffer
+            ReserveInstanceBuffer(snapshot.instances.size());
+            frameIndex = (frameIndex + 1) % FramesInFlight;
+            instance_offset = std::uint64_t(frameIndex) * instanceCapacity * sizeof(InstanceData);
+            wgpuQueueWriteBuffer(queue, instance_buffer, instance_offset, upload, instance_bytes);
+        }
 
         //create command encoder
         WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(device, nullptr);
 
-        //get surface texture to draw to
+        //get surface texture to draw to, or the offscreen one when headless
         WGPUSurfaceTexture surface_texture{};
-        wgpuSurfaceGetCurrentTexture(surface, &surface_texture);
-        WGPUTextureView current_texture_view = wgpuTextureCreateView(surface_texture.texture, nullptr);
+        WGPUTextureView current_texture_view = offscreen_view;
+        if (surface) {
+            wgpuSurfaceGetCurrentTexture(surface, &surface_texture);
+            current_texture_view = wgpuTextureCreateView(surface_texture.texture, nullptr);
+        }
 
         //start the render pass
         WGPURenderPassEncoder render_pass = wgpuCommandEncoderBeginRenderPass(encoder, to_ptr<WGPURenderPassDescriptor>({
@@ -494,21 +852,27 @@ namespace momoengine {
             }})
         }));
 
-        //set the pipeline
-        wgpuRenderPassEncoderSetPipeline(render_pass, pipeline);
-
-        //attach vertex data for the quad as slot 0
-        wgpuRenderPassEncoderSetVertexBuffer(render_pass, 0 /* slot */, vertex_buffer, 0, 4 * 4 * sizeof(float));
+        if (instance_bytes > 0) {
+            //set the pipeline
+            wgpuRenderPassEncoderSetPipeline(render_pass, pipeline);
 
-        //attach instance data as slot 1
-        wgpuRenderPassEncoderSetVertexBuffer(render_pass, 1 /* slot */, instance_buffer, 0, sizeof(InstanceData) * instances.size());
+            //attach vertex data for the quad as slot 0
+            wgpuRenderPassEncoderSetVertexBuffer(render_pass, 0 /* slot */, vertex_buffer, 0, 4 * 4 * sizeof(float));
 
-        //bind group
-        wgpuRenderPassEncoderSetBindGroup(render_pass, 0, bind_group, 0, nullptr);
+            //attach instance data as slot 1
+            wgpuRenderPassEncoderSetVertexBuffer(render_pass, 1 /* slot */, instance_buffer, instance_offset, instance_bytes);
 
-        //draw the sprites
-        for (size_t i = 0; i < instances.size(); ++i) {
-            wgpuRenderPassEncoderDraw(render_pass, 4, 1, 0, i);
+            //draw the sprites, one instanced draw per atlas page
+            std::uint32_t bound_page = NoInstance;
+            for (const Batch& batch : snapshot.batches) {
+                if (batch.page != bound_page) {
+                    wgpuRenderPassEncoderSetBindGroup(render_pass, 0, atlasPages[batch.page].bind_group, 0, nullptr);
+                    bound_page = batch.page;
+                    ++frameStats.bindGroupChanges;
+                }
+                wgpuRenderPassEncoderDraw(render_pass, 4, batch.count, 0, batch.first);
+                ++frameStats.drawCalls;
+            }
         }
 
         //end render pass
@@ -518,23 +882,287 @@ namespace momoengine {
         WGPUCommandBuffer command_buffer = wgpuCommandEncoderFinish(encoder, nullptr);
         wgpuQueueSubmit(queue, 1, &command_buffer);
 
+        //cleanup
+        wgpuCommandBufferRelease(command_buffer);
+        wgpuCommandEncoderRelease(encoder);
+
         //present the new frame
-        wgpuSurfacePresent(surface);
+        if (surface) {
+            wgpuSurfacePresent(surface);
+            wgpuTextureViewRelease(current_texture_view);
+            wgpuTextureRelease(surface_texture.texture);
+        }
+    }
 
-        //cleanup
-        wgpuTextureViewRelease(current_texture_view);
+    bool GraphicsManager::ReadFrame(std::vector<unsigned char>& pixels) {
+        if (!offscreen_texture) {
+            spdlog::error("ReadFrame needs headless mode; a window's frames can't be read back.");
+            return false;
+        }
+
+        //texture to buffer copies need rows padded to 256 bytes
+        std::uint32_t row_bytes = (std::uint32_t)offscreen_width * 4;
+        std::uint32_t padded_row_bytes = (row_bytes + 255) & ~255u;
+        std::uint64_t size = std::uint64_t(padded_row_bytes) * offscreen_height;
+
+        WGPUBuffer readback = wgpuDeviceCreateBuffer(device, to_ptr(WGPUBufferDescriptor{
+            .label = WGPUStringView("Readback Buffer", WGPU_STRLEN),
+            .usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_MapRead,
+            .size = size
+        }));
+
+        WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(device, nullptr);
+        wgpuCommandEncoderCopyTextureToBuffer(
+            encoder,
+            to_ptr<WGPUTexelCopyTextureInfo>({ .texture = offscreen_texture }),
+            to_ptr<WGPUTexelCopyBufferInfo>({
+                .layout = { .bytesPerRow = padded_row_bytes, .rowsPerImage = (uint32_t)offscreen_height },
+                .buffer = readback
+            }),
+            to_ptr(WGPUExtent3D{ (uint32_t)offscreen_width, (uint32_t)offscreen_height, 1 })
+        );
+        WGPUCommandBuffer command_buffer = wgpuCommandEncoderFinish(encoder, nullptr);
+        wgpuQueueSubmit(queue, 1, &command_buffer);
         wgpuCommandBufferRelease(command_buffer);
         wgpuCommandEncoderRelease(encoder);
-        wgpuTextureRelease(surface_texture.texture);
-        wgpuBufferRelease(instance_buffer);
+
+        //mapping completes once the GPU has finished every frame submitted before the copy
+        struct MapRequest {
+            WGPUMapAsyncStatus status = WGPUMapAsyncStatus_Error;
+            bool done = false;
+        } map_request;
+        wgpuBufferMapAsync(readback, WGPUMapMode_Read, 0, size, WGPUBufferMapCallbackInfo{
+            .mode = WGPUCallbackMode_AllowProcessEvents,
+            .callback = [](WGPUMapAsyncStatus status, WGPUStringView, void* request_ptr, void*) {
+                auto* request = static_cast<MapRequest*>(request_ptr);
+                request->status = status;
+                request->done = true;
+            },
+            .userdata1 = &map_request
+        });
+        while (!map_request.done) wgpuInstanceProcessEvents(instance);
+
+        bool ok = map_request.status == WGPUMapAsyncStatus_Success;
+        if (ok) {
+            const auto* mapped = static_cast<const unsigned char*>(wgpuBufferGetConstMappedRange(readback, 0, size));
+            pixels.resize((std::size_t)row_bytes * offscreen_height);
+            for (int y = 0; y < offscreen_height; ++y) {
+                std::memcpy(&pixels[(std::size_t)y * row_bytes], mapped + (std::size_t)y * padded_row_bytes, row_bytes);
+            }
+            wgpuBufferUnmap(readback);
+        }
+        else {
+            spdlog::error("Failed to map the readback buffer.");
+        }
+        wgpuBufferRelease(readback);
+        return ok;
+    }
+
+    bool GraphicsManager::SaveFrame(const std::string& path) {
+        std::vector<unsigned char> pixels;
+        if (!ReadFrame(pixels)) return false;
+
+        if (!stbi_write_png(path.c_str(), offscreen_width, offscreen_height, 4, pixels.data(), offscreen_width * 4)) {
+            spdlog::error("Failed to write {}", path);
+            return false;
+        }
+        return true;
+    }
+
+    //layer in the top 16 bits, then z, then the atlas page; all compare correctly as one unsigned number
+    std::uint64_t GraphicsManager::SortKey(const Sprite& sprite, std::uint32_t page) {
+        std::uint32_t layer = std::uint32_t(std::clamp(sprite.layer, -32768, 32767) + 32768);
+
+        //flip float bits so they order like unsigned integers: negatives reversed below positives
+        std::uint32_t depth;
+        std::memcpy(&depth, &sprite.z, sizeof(depth));
+        depth = (depth & 0x80000000u) ? ~depth : depth | 0x80000000u;
+
+        return std::uint64_t(layer) << 48 | std::uint64_t(depth) << 16 | (page & 0xFFFFu);
+    }
+
+    void GraphicsManager::BuildBatches(RenderSnapshot& snapshot) {
+        if (orderDirty) {
+            //only instances filed in on-screen cells are drawn; the GPU clips the few in edge cells that aren't visible
+            drawOrder.clear();
+            grid.ForEachInRange(visibleCells, [&](std::uint32_t i) {
+                drawOrder.push_back({ instanceKeys[i], i });
+            });
+            RadixSort(drawOrder, sortScratch);
+            snapshot.stats.fullSort = true;
+        }
+        else if (keysChanged > 0) {
+            for (SortEntry& entry : drawOrder) {
+                entry.key = instanceKeys[entry.instance];
+            }
+
+            //last frame's order is nearly sorted when only a few keys moved
+            if (keysChanged * 16 < drawOrder.size()) {
+                InsertionSort(drawOrder);
+            }
+            else {
+                RadixSort(drawOrder, sortScratch);
+                snapshot.stats.fullSort = true;
+            }
+        }
+
+        if (orderDirty || keysChanged > 0) {
+            batches.clear();
+            for (std::uint32_t i = 0; i < drawOrder.size(); ++i) {
+                std::uint32_t page = std::uint32_t(drawOrder[i].key & 0xFFFFu);
+                if (batches.empty() || batches.back().page != page) batches.push_back({ page, i, 0 });
+                ++batches.back().count;
+            }
+            orderDirty = false;
+            keysChanged = 0;
+        }
+
+        //positions change every frame even when the order doesn't
+        //instances that didn't move this extract were in the same place a tick ago
+        snapshot.batches = batches;
+        snapshot.instances.resize(drawOrder.size());
+        snapshot.previousTranslations.resize(drawOrder.size());
+        for (std::size_t i = 0; i < drawOrder.size(); ++i) {
+            const InstanceData& data = instances[drawOrder[i].instance];
+            const Motion& motion = instanceMotion[drawOrder[i].instance];
+            snapshot.instances[i] = data;
+            snapshot.previousTranslations[i] = motion.extract == extractCount ? motion.from : data.translation;
+        }
+    }
+
+    void GraphicsManager::ReserveInstanceBuffer(std::size_t count) {
+        if (count <= instanceCapacity) return;
+
+        //double so that a slowly growing sprite count only recreates the buffer a handful of times
+        std::uint32_t capacity = std::max<std::uint32_t>(instanceCapacity, 256);
+        while (capacity < count) capacity *= 2;
+
+        //WebGPU keeps the old buffer alive until the frames that use it are done
+        if (instance_buffer) wgpuBufferRelease(instance_buffer);
+        instance_buffer = wgpuDeviceCreateBuffer(device, to_ptr<WGPUBufferDescriptor>({
+            .label = WGPUStringView("Instance Buffer", WGPU_STRLEN),
+            .usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex,
+            .size = std::uint64_t(FramesInFlight) * capacity * sizeof(InstanceData)
+        }));
+        instanceCapacity = capacity;
+        ++frameStats.buffersCreated;
+        spdlog::info("Instance buffer grown to {} instances per frame.", capacity);
+    }
+
+    void GraphicsManager::UpdateInstances(EntityManager& entities) {
+        EntityManager::Tick since = lastDrawTick;
+        lastDrawTick = entities.MarkTick();
+
+        //drop sprites whose entity lost its Sprite or Position, or was destroyed
+        entities.ForEachRemoved<Sprite>(since, [&](EntityManager::Entity id) { RemoveInstance(id); });
+        entities.ForEachRemoved<Position>(since, [&](EntityManager::Entity id) { RemoveInstance(id); });
+
+        //add or refresh the sprites that were added or changed since the last draw
+        //texture lookups race with the render side filling in new ones
+        std::lock_guard<std::mutex> lock(textureMutex);
+        auto& view = entities.GetView<const Sprite, const Position>();
+        auto update = [&](EntityManager::Entity id, const Sprite& sprite, const Position& pos) {
+            SetInstance(id, sprite, pos);
+        };
+
+        //a newly loaded texture can change the page and UV rect of sprites that didn't change themselves
+        if (texturesChanged) {
+            view.ForEach(update);
+            texturesChanged = false;
+            return;
+        }
+        view.ForEach(Changed<Position>{ since }, update);
+        view.ForEach(Changed<Sprite>{ since }, update);
+    }
+
+    void GraphicsManager::SetInstance(EntityManager::Entity id, const Sprite& sprite, const Position& pos) {
+        std::uint32_t index = EntityManager::IndexOf(id);
+        if (index >= instanceOfEntity.size()) {
+            instanceOfEntity.resize(index + 1, NoInstance);
+        }
+
+        //a leftover instance from an older entity with the same index
+        if (instanceOfEntity[index] != NoInstance && instanceOwners[instanceOfEntity[index]] != id) {
+            RemoveInstance(instanceOwners[instanceOfEntity[index]]);
+        }
+
+        if (instanceOfEntity[index] == NoInstance) {
+            instanceOfEntity[index] = (std::uint32_t)instances.size();
+            instances.emplace_back();
+            instanceOwners.push_back(id);
+            instanceKeys.push_back(0);
+            instanceMotion.push_back({ glm::vec3(pos.x, pos.y, 0.0f), extractCount });
+            grid.Insert(instanceOfEntity[index], pos.x, pos.y);
+            orderDirty = true;
+        }
+        else if (grid.Move(instanceOfEntity[index], pos.x, pos.y)) {
+            orderDirty = true;  //may have moved on or off screen
+        }
+
+        //sprites whose texture isn't loaded draw the placeholder until it is
+        auto texture = textures.find(sprite.image_name);
+        const TextureInfo& info = texture != textures.end() ? texture->second : placeholder;
+        std::uint64_t key = SortKey(sprite, info.page);
+        std::uint64_t& instanceKey = instanceKeys[instanceOfEntity[index]];
+        if (instanceKey != key) {
+            instanceKey = key;
+            ++keysChanged;
+        }
+
+        //remember where it moved from the first time it's touched in an extract
+        InstanceData& data = instances[instanceOfEntity[index]];
+        Motion& motion = instanceMotion[instanceOfEntity[index]];
+        if (motion.extract != extractCount) motion = { data.translation, extractCount };
+        data.translation = glm::vec3(pos.x, pos.y, 0.0f);
+
+        //simple uniform scale
+        data.scale = glm::vec2(0.25f, 0.25f);
+        maxSpriteExtent = std::max({ maxSpriteExtent, data.scale.x, data.scale.y });
+
+        data.uvRect = info.uvRect;
+    }
+
+    void GraphicsManager::RemoveInstance(EntityManager::Entity id) {
+        std::uint32_t index = EntityManager::IndexOf(id);
+        if (index >= instanceOfEntity.size()) return;
+
+        std::uint32_t slot = instanceOfEntity[index];
+        if (slot == NoInstance || instanceOwners[slot] != id) return;
+
+        //move the last instance into the hole
+        std::uint32_t last = (std::uint32_t)instances.size() - 1;
+        grid.Remove(slot);
+        if (slot != last) {
+            grid.Renumber(last, slot);
+            instances[slot] = instances[last];
+            instanceOwners[slot] = instanceOwners[last];
+            instanceKeys[slot] = instanceKeys[last];
+            instanceMotion[slot] = instanceMotion[last];
+            instanceOfEntity[EntityManager::IndexOf(instanceOwners[slot])] = slot;
+        }
+        instances.pop_back();
+        instanceOwners.pop_back();
+        instanceKeys.pop_back();
+        instanceMotion.pop_back();
+        instanceOfEntity[index] = NoInstance;
+        orderDirty = true;
     }
 
     void GraphicsManager::Shutdown() {
-        //release bind group
-        if (bind_group) {
-            wgpuBindGroupRelease(bind_group);
-            bind_group = nullptr;
+        //let queued decodes finish, then drop the images that never got uploaded
+        SetJobSystem(nullptr);
+        for (TextureLoad& load : uploadQueue) {
+            if (load.pixels) stbi_image_free(load.pixels);
         }
+        uploadQueue.clear();
+
+        //release the atlas pages
+        for (AtlasPage& page : atlasPages) {
+            wgpuBindGroupRelease(page.bind_group);
+            wgpuTextureViewRelease(page.view);
+            wgpuTextureRelease(page.texture);
+        }
+        atlasPages.clear();
 
         //release sampler
         if (sampler) {
@@ -542,16 +1170,18 @@ namespace momoengine {
             sampler = nullptr;
         }
 
-        //release pipeline
-        if (pipeline) {
-            wgpuRenderPipelineRelease(pipeline);
-            pipeline = nullptr;
+        //release pipelines and shaders
+        pipelines.Shutdown();
+        pipeline = nullptr;
+
+        if (pipeline_layout) {
+            wgpuPipelineLayoutRelease(pipeline_layout);
+            pipeline_layout = nullptr;
         }
 
-        //release shader
-        if (shader_module) {
-            wgpuShaderModuleRelease(shader_module);
-            shader_module = nullptr;
+        if (bind_group_layout) {
+            wgpuBindGroupLayoutRelease(bind_group_layout);
+            bind_group_layout = nullptr;
         }
 
         //release the buffers
@@ -565,17 +1195,22 @@ namespace momoengine {
             uniform_buffer = nullptr;
         }
 
+        if (offscreen_view) {
+            wgpuTextureViewRelease(offscreen_view);
+            offscreen_view = nullptr;
+        }
+
+        if (offscreen_texture) {
+            wgpuTextureRelease(offscreen_texture);
+            offscreen_texture = nullptr;
+        }
+
         if (instance_buffer) {
             wgpuBufferRelease(instance_buffer);
             instance_buffer = nullptr;
+            instanceCapacity = 0;
         }
 
-        //release textures stored in the map
-        for (auto& [name, texInfo] : textures) {
-            if (texInfo.view) {
-                wgpuTextureViewRelease(texInfo.view);
-            }
-        }
         textures.clear();
 
         //release WebGPU objects
@@ -604,12 +1239,12 @@ namespace momoengine {
             instance = nullptr; 
         }
 
-        //destroy GLFW window
+        //destroy GLFW window; headless mode never started GLFW
         if (window) {
             glfwDestroyWindow(window);
             window = nullptr;
+            glfwTerminate();
         }
-        glfwTerminate();
         spdlog::info("GLFW shutdown complete");
     }
 
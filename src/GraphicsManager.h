@@ -5,21 +5,113 @@ struct GLFWwindow;
 
 #include <unordered_map>
 #include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <glm/glm.hpp>
 
 #include "Sprite.h" //so we can work with sprites
 #include "EntityManager.h"  //for working with components
+#include "JobSystem.h"      //for decoding textures on worker threads
+#include "SpriteGrid.h"     //for culling
+#include "PipelineCache.h"  //for building pipelines
+#include "Types.h"          //for Camera
 
 namespace momoengine {
 
     class GraphicsManager {
     public:
         bool Startup(int window_width, int window_height, const char* window_name, bool fullscreen);
+
+        //renders into an offscreen texture with no window, e.g. for benchmarks and image tests on machines without a display
+        //Software is Dawn's CPU fallback adapter; Null runs the whole pipeline but draws nothing
+        enum class HeadlessBackend { Default, Software, Null };
+        bool StartupHeadless(int width, int height, HeadlessBackend backend = HeadlessBackend::Software);
+
+        //where compiled shaders are kept between runs (Dawn only); empty turns it off. Set before Startup
+        void SetShaderCacheDirectory(std::string directory) { pipelines.SetDiskCacheDirectory(std::move(directory)); }
+
+        //how long each part of the last Startup() took
+        struct StartupStage {
+            const char* name;
+            double milliseconds;
+        };
+        const std::vector<StartupStage>& GetStartupTimings() const { return startupTimings; }
+
         void Shutdown();
-        bool LoadTexture(const std::string& name, const std::string& path);
-        void Draw(EntityManager& entities);
+        bool LoadTexture(const std::string& name, const std::string& path);     //decodes and uploads right away
+
+        //decodes on the job system and uploads during a later Render(), a few images per frame
+        //sprites using `name` draw with a placeholder until then
+        using TextureHandle = std::uint32_t;
+        enum class TextureState { Loading, Ready, Failed };
+        TextureHandle LoadTextureAsync(const std::string& name, const std::string& path);
+        TextureState GetTextureState(TextureHandle handle) const;
+
+        //decodes run on jobSystem when set; clearing it waits for the decodes already queued
+        void SetJobSystem(JobSystem* jobSystem);
+
+        void Draw(EntityManager& entities);     //Extract() and Render() in one go
         //void Draw(const std::vector<Sprite>& sprites); --old version
 
-        GLFWwindow* GetWindow() const { return window; }
+        GLFWwindow* GetWindow() const { return window; }    //nullptr when headless
+
+        //Fifo waits for vblank and never tears; Mailbox doesn't wait, replacing a queued frame for lower latency;
+        //Immediate doesn't wait and may tear. Unsupported modes fall back to Fifo. Ignored when headless
+        enum class PresentMode { Fifo, Mailbox, Immediate };
+        void SetPresentMode(PresentMode mode);
+
+        //copies the last headless frame back as tightly packed RGBA rows; waits for the GPU
+        bool ReadFrame(std::vector<unsigned char>& pixels);
+        bool SaveFrame(const std::string& path);    //ReadFrame() written out as a PNG
+
+        //counters for the last Draw() or Render(); a steady-state frame should create no GPU buffers and allocate nothing
+        struct FrameStats {
+            std::uint32_t instances = 0;        //sprites sent to the GPU
+            std::uint32_t culledInstances = 0;  //sprites skipped because their grid cell is off screen
+            std::uint32_t batches = 0;          //runs of instances sharing an atlas page
+            bool fullSort = false;              //the draw order was radix sorted from scratch rather than patched
+            std::uint32_t drawCalls = 0;
+            std::uint32_t bindGroupChanges = 0;
+            std::uint32_t texturesUploaded = 0;     //async loads that reached the atlas this frame
+            std::size_t textureBytesUploaded = 0;
+            std::uint32_t buffersCreated = 0;   //GPU buffers created during the frame
+            std::uint32_t cpuAllocations = 0;   //times the CPU-side instance arrays had to grow
+        };
+        const FrameStats& GetFrameStats() const { return frameStats; }
+
+        //per-sprite data for the instance buffer
+        struct InstanceData {
+            glm::vec3 translation;
+            glm::vec2 scale;
+            glm::vec4 uvRect;   //the sprite's image inside its atlas page
+            // rotation?
+        };
+
+        //a run of instances drawn from one atlas page
+        struct Batch {
+            std::uint32_t page;
+            std::uint32_t first;
+            std::uint32_t count;
+        };
+
+        //everything Render() needs from one simulation tick, so the simulation can move on while it's drawn
+        struct RenderSnapshot {
+            double time = 0.0;      //when the tick happened, set by whoever publishes the snapshot
+            Camera camera;
+            Camera previousCamera;  //the camera one tick earlier
+            std::vector<InstanceData> instances;            //visible instances in draw order
+            std::vector<glm::vec3> previousTranslations;    //where each of those was one tick earlier
+            std::vector<Batch> batches;
+            FrameStats stats;       //the counters Extract() fills in
+        };
+
+        //Extract() and Render() may run on different threads, one each; snapshots are never shared while being written
+        //Startup(), Shutdown(), LoadTexture() and ReadFrame() belong to the render side, LoadTextureAsync() to either
+        void Extract(EntityManager& entities, RenderSnapshot& snapshot);   //brings the instances up to date and writes out what's visible
+        void Render(const RenderSnapshot& snapshot, float alpha = 1.0f);   //draws snapshot blended alpha of the way from its previous tick
 
     private:
         GLFWwindow* window = nullptr;
@@ -34,20 +126,135 @@ namespace momoengine {
         WGPUBuffer instance_buffer = nullptr;
         WGPUBuffer uniform_buffer = nullptr;
         
-        WGPUShaderModule shader_module = nullptr;
-        WGPURenderPipeline pipeline = nullptr;
+        WGPUTextureFormat color_format = WGPUTextureFormat_Undefined;   //what the pipeline renders into
+        PresentMode present_mode = PresentMode::Fifo;
+        std::vector<WGPUPresentMode> present_modes;     //what the surface supports
+
+        //headless render target
+        WGPUTexture offscreen_texture = nullptr;
+        WGPUTextureView offscreen_view = nullptr;
+        int offscreen_width = 0;
+        int offscreen_height = 0;
+
+        PipelineCache pipelines;
+        WGPUBindGroupLayout bind_group_layout = nullptr;
+        WGPUPipelineLayout pipeline_layout = nullptr;
+        WGPURenderPipeline pipeline = nullptr;  //owned by pipelines
+
+        std::vector<StartupStage> startupTimings;
+        double stageStart = 0.0;
 
         WGPUSampler sampler = nullptr;
-        WGPUBindGroup bind_group = nullptr;
 
-        //gets the width and height for each texture
-        struct TextureInfo {
+        //images are packed into a few large atlas pages, so sprites with different images share one bind group
+        //each page fills shelf by shelf: images go left to right, and a new shelf starts below the tallest one
+        static constexpr int AtlasPageSize = 2048;
+        static constexpr int AtlasPadding = 1;     //edge pixels repeated around each image so linear filtering doesn't bleed
+        struct AtlasPage {
+            WGPUTexture texture;
             WGPUTextureView view;
+            WGPUBindGroup bind_group;
+            int size;
+            int shelfX, shelfY, shelfHeight;
+        };
+        std::vector<AtlasPage> atlasPages;
+
+        //gets the width and height for each texture, and where it sits in the atlas
+        struct TextureInfo {
             int width;
             int height;
+            std::uint32_t page;     //index into atlasPages, used to batch sprites
+            glm::vec4 uvRect;       //u, v of the top-left corner, then width and height in UV units
         };
 
+        //textures, textureStates and texturesChanged are shared by the Extract() and Render() sides
+        mutable std::mutex textureMutex;
         std::unordered_map<std::string, TextureInfo> textures;
+        TextureInfo placeholder{};     //checkerboard for sprites whose texture isn't loaded (yet)
+
+        //async loads: queued for a worker, decoded, then uploaded by Render() within UploadBudgetBytes per frame
+        static constexpr std::size_t UploadBudgetBytes = 4 * 1024 * 1024;
+        struct TextureLoad {
+            TextureHandle handle;
+            std::string name;
+            std::string path;
+            unsigned char* pixels = nullptr;   //nullptr after decoding means it failed
+            int width = 0;
+            int height = 0;
+        };
+        JobSystem* jobs = nullptr;  //owned by Engine
+        std::mutex loadMutex;
+        std::deque<TextureLoad> decodeQueue;    //waiting for a worker
+        std::deque<TextureLoad> uploadQueue;    //decoded, waiting for Render()
+        std::atomic<std::size_t> decodesInFlight{ 0 };
+        std::vector<TextureState> textureStates;    //TextureHandle -> state
+        JobSystem::RangeFunc decodeTask = [this](std::size_t, std::size_t) { DecodeNext(); };   //one queued load per task
+
+        //CPU copy of the instance data, patched from EntityManager change tracking instead of rebuilt every frame
+        static constexpr std::uint32_t NoInstance = ~0u;
+        std::vector<InstanceData> instances;
+        std::vector<EntityManager::Entity> instanceOwners;     //entity drawn by each instance
+        std::vector<std::uint64_t> instanceKeys;               //sort key of each instance, see SortKey()
+        std::vector<std::uint32_t> instanceOfEntity;           //entity index -> instance, or NoInstance
+        EntityManager::Tick lastDrawTick = 0;
+        bool texturesChanged = false;   //a texture was loaded, so every instance's key is looked up again
+
+        //where each instance was before it last moved, so snapshots can blend between ticks
+        struct Motion {
+            glm::vec3 from;
+            std::uint32_t extract;  //the Extract() it moved in; older means it has sat still since
+        };
+        std::vector<Motion> instanceMotion;
+        std::uint32_t extractCount = 0;
+        Camera lastCamera;
+
+        //visible instances in draw order: by layer, then depth, then atlas page, so equal depths batch together
+        //a full radix sort when the visible set changes; an insertion sort over last frame's order when only a few keys did
+        struct SortEntry {
+            std::uint64_t key;
+            std::uint32_t instance;
+        };
+        std::vector<SortEntry> drawOrder;
+        std::vector<SortEntry> sortScratch;         //radix sort ping-pong buffer
+        std::vector<Batch> batches;                 //copied into every snapshot, since only changed orders rebuild them
+        std::uint32_t keysChanged = 0;  //instances whose sort key changed since the last sort
+        bool orderDirty = false;
+
+        //instances filed by position; only the cells under the camera are gathered, so draw cost follows what's visible
+        SpriteGrid grid;
+        SpriteGrid::CellRange visibleCells;
+        float maxSpriteExtent = 0.0f;   //half size of the biggest sprite seen, how far past the screen edge to look
+        std::atomic<int> viewWidth{ 0 };    //framebuffer size as of the last Render(), for culling on the Extract() side
+        std::atomic<int> viewHeight{ 0 };
+
+        RenderSnapshot drawSnapshot;    //what Draw() extracts into
+        std::vector<InstanceData> blendedInstances;     //a snapshot's instances moved to where Render() shows them
+
+        //instance_buffer holds FramesInFlight regions of instanceCapacity instances each
+        //every frame writes its own region, so frames the GPU hasn't finished yet are never overwritten
+        static constexpr std::uint32_t FramesInFlight = 3;
+        std::uint32_t instanceCapacity = 0;     //instances per region
+        std::uint32_t frameIndex = 0;           //which region this frame writes
+        FrameStats frameStats;
+
+        bool StartupDevice(const WGPURequestAdapterOptions& options);
+        bool StartupResources();
+        void ConfigureSurface();    //for the window's current size and present_mode
+        void EndStage(const char* name);    //records the time since the last stage ended
+
+        //copies RGBA pixels into an atlas page, adding a page when none has room, and reports where they went
+        bool AddToAtlas(const unsigned char* pixels, int width, int height, TextureInfo& placed);
+        AtlasPage& CreateAtlasPage(int size);
+
+        void DecodeNext();      //worker side: decodes the oldest queued load
+        void UploadTextures();  //render side: moves decoded loads into the atlas
+
+        void UpdateInstances(EntityManager& entities);
+        static std::uint64_t SortKey(const Sprite& sprite, std::uint32_t page);
+        void BuildBatches(RenderSnapshot& snapshot);
+        void ReserveInstanceBuffer(std::size_t count);  //grows the regions geometrically to fit count instances
+        void SetInstance(EntityManager::Entity id, const Sprite& sprite, const Position& pos);
+        void RemoveInstance(EntityManager::Entity id);
     };
 
 }
@@ -3,9 +3,20 @@
 namespace momoengine {
 	void InputManager::Startup(GLFWwindow* w) {
 		window = w;
+		if (!window) return;
+
+		glfwSetWindowUserPointer(window, this);
+		glfwSetKeyCallback(window, [](GLFWwindow* window, int key, int, int action, int) {
+			if (key < 0 || key > GLFW_KEY_LAST) return;	//GLFW_KEY_UNKNOWN
+
+			auto* input = static_cast<InputManager*>(glfwGetWindowUserPointer(window));
+			if (action == GLFW_PRESS) input->keys[key].store(true, std::memory_order_relaxed);
+			else if (action == GLFW_RELEASE) input->keys[key].store(false, std::memory_order_relaxed);
+		});
 	}
 
 	void InputManager::Shutdown() {
+		if (window) glfwSetKeyCallback(window, nullptr);
 		window = nullptr;
 	}
 
@@ -14,8 +25,8 @@ namespace momoengine {
 	}
 
 	bool InputManager::KeyIsPressed(int key) const {
-		if (!window) return false;
+		if (!window || key < 0 || key > GLFW_KEY_LAST) return false;
 
-		return glfwGetKey(window, key) == GLFW_PRESS;
+		return keys[key].load(std::memory_order_relaxed);
 	}
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 #include <GLFW/glfw3.h>
+#include <array>
+#include <atomic>
 
 namespace momoengine {
 
@@ -8,10 +10,11 @@ namespace momoengine {
         void Startup(GLFWwindow* w);  //stores a pointer to GLFWwindow
         void Shutdown();
         void Update();                     //calls glfwPollEvents()
-        bool KeyIsPressed(int key) const;  //to use glfwGetKey()
+        bool KeyIsPressed(int key) const;  //safe from any thread, e.g. the simulation thread of Engine::RunThreadedGameLoop
 
     private:
         GLFWwindow* window = nullptr;      //gets input state
+        std::array<std::atomic<bool>, GLFW_KEY_LAST + 1> keys{};   //filled in by the key callback during Update(); glfwGetKey is main thread only
     };
 
 }
@@ -0,0 +1,150 @@
+#include "JobSystem.h"
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+
+namespace momoengine {
+
+    namespace {
+        thread_local unsigned currentQueue = 0;     //index of the queue owned by this thread
+    }
+
+    void JobSystem::Startup(unsigned workerCount) {
+        if (running) return;
+
+        if (workerCount == AutoWorkerCount) {
+            unsigned hardware = std::thread::hardware_concurrency();
+            workerCount = hardware > 1 ? hardware - 1 : 0;
+        }
+
+        running = true;
+        queues.clear();
+        for (unsigned i = 0; i <= workerCount; ++i) {
+            queues.push_back(std::make_unique<TaskQueue>());
+        }
+        for (unsigned i = 1; i <= workerCount; ++i) {
+            workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+        }
+        spdlog::info("Job system started with {} worker threads.", workerCount);
+    }
+
+    void JobSystem::Shutdown() {
+        if (!running) return;
+
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            running = false;
+        }
+        wake.notify_all();
+
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        queues.clear();
+        spdlog::info("Job system shut down.");
+    }
+
+    void JobSystem::ParallelFor(std::size_t count, std::size_t grain, const RangeFunc& func) {
+        if (count == 0) return;
+        grain = std::max<std::size_t>(grain, 1);
+
+        //nothing to share the work with
+        if (workers.empty() || count <= grain) {
+            func(0, count);
+            return;
+        }
+
+        std::atomic<std::size_t> remaining{ 0 };
+        Dispatch(count, grain, func, remaining);
+        Wait(remaining);    //other callers' tasks may get run here too
+    }
+
+    void JobSystem::Dispatch(std::size_t count, std::size_t grain, const RangeFunc& func, std::atomic<std::size_t>& remaining) {
+        if (count == 0) return;
+        grain = std::max<std::size_t>(grain, 1);
+
+        //not started: run everything right here
+        if (queues.empty()) {
+            for (std::size_t begin = 0; begin < count; begin += grain) {
+                func(begin, std::min(count, begin + grain));
+            }
+            return;
+        }
+
+        std::size_t taskCount = (count + grain - 1) / grain;
+        remaining.fetch_add(taskCount, std::memory_order_relaxed);
+        //counted before they're pushed, so a worker taking one right away can't bring the count below zero
+        queued.fetch_add(taskCount);
+
+        //deal the ranges out round-robin, starting with our own queue, so every worker starts with local work
+        for (std::size_t t = 0; t < taskCount; ++t) {
+            TaskQueue& queue = *queues[(currentQueue + t) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back({ &func, t * grain, std::min(count, (t + 1) * grain), &remaining });
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);   //pairs with the predicate check in WorkerLoop
+        }
+        wake.notify_all();
+    }
+
+    void JobSystem::Wait(const std::atomic<std::size_t>& remaining) {
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            if (!RunOne(currentQueue)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool JobSystem::RunPending() {
+        return !queues.empty() && RunOne(currentQueue);
+    }
+
+    void JobSystem::WorkerLoop(unsigned index) {
+        currentQueue = index;
+
+        while (true) {
+            if (RunOne(index)) continue;
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [&] { return !running || queued.load() > 0; });
+            if (!running) return;
+        }
+    }
+
+    bool JobSystem::RunOne(unsigned index) {
+        Task task{};
+        bool found = false;
+
+        //newest task from our own queue first
+        {
+            TaskQueue& own = *queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                found = true;
+            }
+        }
+
+        //otherwise steal the oldest task from someone else
+        for (std::size_t offset = 1; !found && offset < queues.size(); ++offset) {
+            TaskQueue& victim = *queues[(index + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                found = true;
+            }
+        }
+
+        if (!found) return false;
+
+        queued.fetch_sub(1);
+        (*task.func)(task.begin, task.end);
+        task.remaining->fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace momoengine {
+
+    //work-stealing thread pool: every thread owns a task deque, pops its own work LIFO and steals FIFO from others
+    class JobSystem {
+    public:
+        using RangeFunc = std::function<void(std::size_t begin, std::size_t end)>;
+
+        static constexpr unsigned AutoWorkerCount = ~0u;    //one worker per hardware thread, minus the calling thread
+
+        void Startup(unsigned workerCount = AutoWorkerCount);
+        void Shutdown();
+
+        unsigned ThreadCount() const { return (unsigned)workers.size() + 1; }   //workers plus the calling thread
+
+        //calls func(begin, end) over [0, count) in ranges of at most `grain` items and blocks until all are done
+        //the calling thread runs ranges too while it waits
+        void ParallelFor(std::size_t count, std::size_t grain, const RangeFunc& func);
+
+        //queues the same ranges as ParallelFor but returns at once; `remaining` goes up by the number of
+        //ranges queued and back down as each one finishes. func and remaining must outlive the tasks
+        //may be called from inside a task, e.g. to queue work that depended on it
+        void Dispatch(std::size_t count, std::size_t grain, const RangeFunc& func, std::atomic<std::size_t>& remaining);
+
+        //runs queued tasks on the calling thread until `remaining` reaches zero
+        void Wait(const std::atomic<std::size_t>& remaining);
+
+        //runs one queued task on the calling thread; false if there was nothing to run
+        bool RunPending();
+
+        ~JobSystem() { Shutdown(); }
+
+    private:
+        struct Task {
+            const RangeFunc* func;
+            std::size_t begin, end;
+            std::atomic<std::size_t>* remaining;    //tasks left in the ParallelFor that queued this one
+        };
+
+        struct TaskQueue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<TaskQueue>> queues;     //queues[0] belongs to threads outside the pool
+        std::vector<std::thread> workers;
+
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        std::atomic<std::size_t> queued{ 0 };   //tasks sitting in any queue
+        bool running = false;
+
+        void WorkerLoop(unsigned index);
+        bool RunOne(unsigned index);    //runs one task from our queue or a stolen one; false if every queue was empty
+    };
+
+}
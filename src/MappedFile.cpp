@@ -0,0 +1,87 @@
+#include "MappedFile.h"
+#include "spdlog/spdlog.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::Open(const std::filesystem::path& path) {
+	Close();
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) {
+		spdlog::error("Could not open {}", path.string());
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0) {
+		spdlog::error("Could not map {}: empty or unreadable file", path.string());
+		CloseHandle(handle);
+		return false;
+	}
+
+	HANDLE view = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void* mapped = view ? MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!mapped) {
+		spdlog::error("Could not map {}", path.string());
+		if (view) CloseHandle(view);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file = handle;
+	mapping = view;
+	data = static_cast<const std::byte*>(mapped);
+	size = (std::size_t)fileSize.QuadPart;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		spdlog::error("Could not open {}", path.string());
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		spdlog::error("Could not map {}: empty or unreadable file", path.string());
+		close(fd);
+		return false;
+	}
+
+	void* mapped = mmap(nullptr, (std::size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);	//the mapping keeps the file alive
+	if (mapped == MAP_FAILED) {
+		spdlog::error("Could not map {}", path.string());
+		return false;
+	}
+	madvise(mapped, (std::size_t)info.st_size, MADV_SEQUENTIAL);
+
+	data = static_cast<const std::byte*>(mapped);
+	size = (std::size_t)info.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::Close() {
+	if (!data) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle(mapping);
+	CloseHandle(file);
+	file = nullptr;
+	mapping = nullptr;
+#else
+	munmap(const_cast<std::byte*>(data), size);
+#endif
+	data = nullptr;
+	size = 0;
+}
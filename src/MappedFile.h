@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+//read-only memory mapping of a whole file; the bytes stay valid until the object is destroyed or closed
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::filesystem::path& path);
+	void Close();
+
+	const std::byte* Data() const { return data; }
+	std::size_t Size() const { return size; }
+
+private:
+	const std::byte* data = nullptr;
+	std::size_t size = 0;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
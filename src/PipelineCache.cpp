@@ -0,0 +1,278 @@
+#include "PipelineCache.h"
+#include "FramePacer.h"     //for its clock
+#include "spdlog/spdlog.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string_view>
+
+namespace momoengine {
+
+    namespace {
+        template <typename T>
+        void Combine(std::size_t& seed, const T& value) {
+            seed ^= std::hash<T>{}(value) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+        }
+
+        bool SameAttributes(const std::vector<WGPUVertexAttribute>& a, const std::vector<WGPUVertexAttribute>& b) {
+            if (a.size() != b.size()) return false;
+            for (std::size_t i = 0; i < a.size(); ++i) {
+                if (a[i].format != b[i].format || a[i].offset != b[i].offset || a[i].shaderLocation != b[i].shaderLocation) return false;
+            }
+            return true;
+        }
+
+        WGPUStringView View(const std::string& text) {
+            return WGPUStringView{ text.data(), text.size() };
+        }
+    }
+
+    bool PipelineCache::Description::operator==(const Description& other) const {
+        if (shader != other.shader || vertexEntry != other.vertexEntry || fragmentEntry != other.fragmentEntry) return false;
+        if (layout != other.layout || topology != other.topology || colorFormat != other.colorFormat || alphaBlend != other.alphaBlend) return false;
+        if (buffers.size() != other.buffers.size()) return false;
+        for (std::size_t i = 0; i < buffers.size(); ++i) {
+            const VertexBuffer& a = buffers[i];
+            const VertexBuffer& b = other.buffers[i];
+            if (a.stepMode != b.stepMode || a.arrayStride != b.arrayStride || !SameAttributes(a.attributes, b.attributes)) return false;
+        }
+        return true;
+    }
+
+    std::size_t PipelineCache::Hash(const Description& description) {
+        std::size_t seed = 0;
+        Combine(seed, description.shader);
+        Combine(seed, description.vertexEntry);
+        Combine(seed, description.fragmentEntry);
+        Combine(seed, (const void*)description.layout);
+        Combine(seed, (int)description.topology);
+        Combine(seed, (int)description.colorFormat);
+        Combine(seed, description.alphaBlend);
+        for (const VertexBuffer& buffer : description.buffers) {
+            Combine(seed, (int)buffer.stepMode);
+            Combine(seed, buffer.arrayStride);
+            for (const WGPUVertexAttribute& attribute : buffer.attributes) {
+                Combine(seed, (int)attribute.format);
+                Combine(seed, attribute.offset);
+                Combine(seed, attribute.shaderLocation);
+            }
+        }
+        return seed;
+    }
+
+    const WGPUChainedStruct* PipelineCache::DeviceExtension(WGPUAdapter adapter) {
+#ifdef WEBGPU_BACKEND_DAWN
+        if (cacheDirectory.empty()) return nullptr;
+
+        std::error_code error;
+        std::filesystem::create_directories(cacheDirectory, error);
+        if (error) {
+            spdlog::warn("Can't create the shader cache in {}: {}", cacheDirectory, error.message());
+            return nullptr;
+        }
+
+        //blobs from one GPU or driver mean nothing to another, so they're kept apart
+        WGPUAdapterInfo info{};
+        wgpuAdapterGetInfo(adapter, &info);
+        isolationKey = fmt::format("{:x}-{:x}-{}", info.vendorID, info.deviceID, (int)info.backendType);
+        wgpuAdapterInfoFreeMembers(info);
+
+        cacheDescriptor = {};
+        cacheDescriptor.chain.sType = WGPUSType_DawnCacheDeviceDescriptor;
+        cacheDescriptor.isolationKey = View(isolationKey);
+        cacheDescriptor.loadDataFunction = [](const void* key, size_t keySize, void* value, size_t valueSize, void* userdata) {
+            return static_cast<PipelineCache*>(userdata)->LoadBlob(key, keySize, value, valueSize);
+        };
+        cacheDescriptor.storeDataFunction = [](const void* key, size_t keySize, const void* value, size_t valueSize, void* userdata) {
+            static_cast<PipelineCache*>(userdata)->StoreBlob(key, keySize, value, valueSize);
+        };
+        cacheDescriptor.functionUserdata = this;
+        spdlog::info("Shader cache in {} ({}).", cacheDirectory, isolationKey);
+        return &cacheDescriptor.chain;
+#else
+        (void)adapter;
+        return nullptr;
+#endif
+    }
+
+    void PipelineCache::Startup(WGPUInstance inst, WGPUDevice dev) {
+        instance = inst;
+        device = dev;
+    }
+
+    void PipelineCache::Shutdown() {
+        for (Entry& entry : entries) {
+            if (entry.pipeline) wgpuRenderPipelineRelease(entry.pipeline);
+        }
+        entries.clear();
+        byHash.clear();
+
+        for (auto& [source, module] : modules) {
+            wgpuShaderModuleRelease(module);
+        }
+        modules.clear();
+    }
+
+    PipelineCache::Handle PipelineCache::Request(const Description& description) {
+        std::size_t hash = Hash(description);
+        auto [first, last] = byHash.equal_range(hash);
+        for (auto it = first; it != last; ++it) {
+            if (entries[it->second].description == description) return it->second;
+        }
+
+        Handle handle = (Handle)entries.size();
+        entries.push_back({ description, hash });
+        byHash.emplace(hash, handle);
+        const Description& desc = entries.back().description;
+        entries.back().requested = FramePacer::Now();
+
+        //the descriptor only has to live through the call, so it points into locals and the stored description
+        std::vector<WGPUVertexBufferLayout> buffers;
+        for (const VertexBuffer& buffer : desc.buffers) {
+            buffers.push_back({
+                .stepMode = buffer.stepMode,
+                .arrayStride = buffer.arrayStride,
+                .attributeCount = buffer.attributes.size(),
+                .attributes = buffer.attributes.data()
+            });
+        }
+
+        WGPUBlendState blend{
+            .color = {
+                .operation = WGPUBlendOperation_Add,
+                .srcFactor = WGPUBlendFactor_SrcAlpha,
+                .dstFactor = WGPUBlendFactor_OneMinusSrcAlpha
+            },
+            .alpha = {
+                .operation = WGPUBlendOperation_Add,
+                .srcFactor = WGPUBlendFactor_Zero,
+                .dstFactor = WGPUBlendFactor_One
+            }
+        };
+        WGPUColorTargetState target{
+            .format = desc.colorFormat,
+            .blend = desc.alphaBlend ? &blend : nullptr,
+            .writeMask = WGPUColorWriteMask_All
+        };
+        WGPUFragmentState fragment{
+            .module = ModuleFor(desc.shader),
+            .entryPoint = View(desc.fragmentEntry),
+            .targetCount = 1,
+            .targets = &target
+        };
+
+        WGPURenderPipelineDescriptor descriptor{
+            .label = View(desc.label),
+            .layout = desc.layout,
+            .vertex = {
+                .module = fragment.module,
+                .entryPoint = View(desc.vertexEntry),
+                .bufferCount = buffers.size(),
+                .buffers = buffers.data()
+            },
+            .primitive = { .topology = desc.topology },
+            .multisample = { .count = 1, .mask = ~0u },
+            .fragment = &fragment
+        };
+        wgpuDeviceCreateRenderPipelineAsync(device, &descriptor, WGPUCreateRenderPipelineAsyncCallbackInfo{
+            //delivered by Poll() or Wait(), never on another thread
+            .mode = WGPUCallbackMode_AllowProcessEvents,
+            .callback = [](WGPUCreatePipelineAsyncStatus status, WGPURenderPipeline pipeline, WGPUStringView message, void* cache_ptr, void* handle_ptr) {
+                auto* cache = static_cast<PipelineCache*>(cache_ptr);
+                Entry& entry = cache->entries[(Handle)(std::uintptr_t)handle_ptr];
+                if (status != WGPUCreatePipelineAsyncStatus_Success) {
+                    spdlog::error("Failed to create pipeline '{}': {}", entry.description.label, std::string_view(message.data, message.length));
+                }
+                else {
+                    spdlog::info("Pipeline '{}' ready after {:.1f} ms.", entry.description.label, (FramePacer::Now() - entry.requested) * 1000.0);
+                }
+                entry.pipeline = pipeline;
+                entry.done = true;
+            },
+            .userdata1 = this,
+            .userdata2 = (void*)(std::uintptr_t)handle
+        });
+        return handle;
+    }
+
+    WGPURenderPipeline PipelineCache::Wait(Handle handle) {
+        while (!entries[handle].done) wgpuInstanceProcessEvents(instance);
+        return entries[handle].pipeline;
+    }
+
+    void PipelineCache::Poll() {
+        wgpuInstanceProcessEvents(instance);
+    }
+
+    WGPUShaderModule PipelineCache::ModuleFor(const std::string& source) {
+        auto it = modules.find(source);
+        if (it != modules.end()) return it->second;
+
+        WGPUShaderSourceWGSL source_desc = {};
+        source_desc.chain.sType = WGPUSType_ShaderSourceWGSL;
+        source_desc.code = View(source);
+        WGPUShaderModuleDescriptor shader_desc = {};
+        shader_desc.nextInChain = &source_desc.chain;
+
+        WGPUShaderModule module = wgpuDeviceCreateShaderModule(device, &shader_desc);
+        modules.emplace(source, module);
+        return module;
+    }
+
+    //FNV-1a of the key names the file; the key is stored too, in case two hash the same
+    std::string PipelineCache::CachePath(const void* key, std::size_t keySize) const {
+        std::uint64_t hash = 0xcbf29ce484222325ull;
+        for (std::size_t i = 0; i < keySize; ++i) {
+            hash = (hash ^ static_cast<const unsigned char*>(key)[i]) * 0x100000001b3ull;
+        }
+        return fmt::format("{}/{:016x}.bin", cacheDirectory, hash);
+    }
+
+    //file layout: key size, key, value
+    std::size_t PipelineCache::LoadBlob(const void* key, std::size_t keySize, void* value, std::size_t valueSize) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        std::ifstream file(CachePath(key, keySize), std::ios::binary | std::ios::ate);
+        if (!file) return 0;
+
+        std::uint64_t fileSize = (std::uint64_t)file.tellg();
+        std::uint64_t storedKeySize = 0;
+        file.seekg(0);
+        if (!file.read(reinterpret_cast<char*>(&storedKeySize), sizeof(storedKeySize)) || storedKeySize != keySize) return 0;
+        if (fileSize < sizeof(storedKeySize) + keySize) return 0;
+
+        std::vector<char> storedKey(keySize);
+        if (!file.read(storedKey.data(), keySize) || std::memcmp(storedKey.data(), key, keySize) != 0) return 0;
+
+        //Dawn asks for the size first, then calls again with room for the value
+        std::size_t size = (std::size_t)(fileSize - sizeof(storedKeySize) - keySize);
+        if (!value || valueSize < size) return size;
+        if (!file.read(static_cast<char*>(value), size)) return 0;
+        return size;
+    }
+
+    void PipelineCache::StoreBlob(const void* key, std::size_t keySize, const void* value, std::size_t valueSize) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        std::string path = CachePath(key, keySize);
+
+        //written aside and renamed into place, so another launch never reads half a file
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            std::uint64_t storedKeySize = keySize;
+            file.write(reinterpret_cast<const char*>(&storedKeySize), sizeof(storedKeySize));
+            file.write(static_cast<const char*>(key), keySize);
+            file.write(static_cast<const char*>(value), valueSize);
+            if (!file) {
+                spdlog::warn("Failed to write shader cache entry {}", path);
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+        if (error) spdlog::warn("Failed to write shader cache entry {}: {}", path, error.message());
+    }
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace momoengine {
+
+    //render pipelines by description: identical descriptions share one pipeline and shader module,
+    //and each pipeline compiles in the background while startup carries on
+    //with Dawn, compiled shaders also go into a blob cache on disk, so later launches skip most of the compiling
+    class PipelineCache {
+    public:
+        //a vertex buffer layout holding its attributes by value, so descriptions can be compared and hashed
+        struct VertexBuffer {
+            WGPUVertexStepMode stepMode = WGPUVertexStepMode_Vertex;
+            std::uint64_t arrayStride = 0;
+            std::vector<WGPUVertexAttribute> attributes;
+        };
+
+        struct Description {
+            std::string label;
+            std::string shader;     //WGSL source
+            std::string vertexEntry = "vertex_shader_main";
+            std::string fragmentEntry = "fragment_shader_main";
+            WGPUPipelineLayout layout = nullptr;
+            std::vector<VertexBuffer> buffers;
+            WGPUPrimitiveTopology topology = WGPUPrimitiveTopology_TriangleList;
+            WGPUTextureFormat colorFormat = WGPUTextureFormat_Undefined;
+            bool alphaBlend = false;    //over compositing that leaves the destination alpha alone
+
+            bool operator==(const Description& other) const;    //the label doesn't count
+        };
+
+        using Handle = std::uint32_t;
+
+        //the directory Dawn's blob cache is kept in; empty turns it off. Set before GraphicsManager creates the device
+        void SetDiskCacheDirectory(std::string directory) { cacheDirectory = std::move(directory); }
+        //chained into the device descriptor to hook up the disk cache; nullptr without Dawn or a directory
+        const WGPUChainedStruct* DeviceExtension(WGPUAdapter adapter);
+
+        void Startup(WGPUInstance instance, WGPUDevice device);
+        void Shutdown();    //releases every pipeline and shader module
+
+        Handle Request(const Description& description);    //starts compiling, unless an identical one was requested before
+        WGPURenderPipeline Get(Handle handle) const { return entries[handle].pipeline; }   //nullptr until compiled, or if it failed
+        WGPURenderPipeline Wait(Handle handle);     //processes events until it's compiled
+        void Poll();    //delivers pipelines that finished compiling
+
+    private:
+        struct Entry {
+            Description description;
+            std::size_t hash;
+            WGPURenderPipeline pipeline = nullptr;
+            bool done = false;
+            double requested = 0.0;     //seconds, for logging how long compiling took
+        };
+
+        WGPUInstance instance = nullptr;
+        WGPUDevice device = nullptr;
+        std::vector<Entry> entries;     //Handle -> entry
+        std::unordered_multimap<std::size_t, Handle> byHash;
+        std::unordered_map<std::string, WGPUShaderModule> modules;     //WGSL source -> module
+
+        //Dawn's blob cache, one file per key; Dawn may call in from its own threads
+        std::string cacheDirectory = "shader_cache";
+        std::string isolationKey;
+        std::mutex cacheMutex;
+#ifdef WEBGPU_BACKEND_DAWN
+        WGPUDawnCacheDeviceDescriptor cacheDescriptor{};
+#endif
+
+        static std::size_t Hash(const Description& description);
+        WGPUShaderModule ModuleFor(const std::string& source);
+        std::string CachePath(const void* key, std::size_t keySize) const;
+        std::size_t LoadBlob(const void* key, std::size_t keySize, void* value, std::size_t valueSize);
+        void StoreBlob(const void* key, std::size_t keySize, const void* value, std::size_t valueSize);
+    };
+
+}
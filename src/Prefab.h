@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <type_traits>
+#include <utility>
+#include "Archetype.h"
+
+//a template set of components that EntityManager::Instantiate copies into new entities
+class Prefab {
+public:
+	struct Entry {
+		const ComponentInfo* info;
+		void* data;		//constructed component, owned by the prefab
+	};
+
+	Prefab() = default;
+	~Prefab() { Clear(); }
+
+	Prefab(const Prefab&) = delete;
+	Prefab& operator=(const Prefab&) = delete;
+
+	Prefab(Prefab&& other) noexcept : entries(std::move(other.entries)) { other.entries.clear(); }
+	Prefab& operator=(Prefab&& other) noexcept {
+		if (this != &other) {
+			Clear();
+			entries = std::move(other.entries);
+			other.entries.clear();
+		}
+		return *this;
+	}
+
+	//adds (or replaces) a component; returns *this so calls can be chained
+	template <typename T>
+	Prefab& Add(T component) {
+		static_assert(std::is_copy_constructible_v<T>, "prefab components are copied into every instance");
+		const ComponentInfo* info = ComponentInfo::Get<T>();
+
+		for (Entry& entry : entries) {
+			if (entry.info == info) {
+				*static_cast<T*>(entry.data) = std::move(component);
+				return *this;
+			}
+		}
+
+		void* data = ::operator new(sizeof(T), std::align_val_t(alignof(T)));
+		new (data) T(std::move(component));
+		entries.push_back({ info, data });
+		return *this;
+	}
+
+	const std::vector<Entry>& Components() const { return entries; }
+
+	void Clear() {
+		for (Entry& entry : entries) {
+			entry.info->Destroy(entry.data);
+			::operator delete(entry.data, std::align_val_t(entry.info->align));
+		}
+		entries.clear();
+	}
+
+private:
+	std::vector<Entry> entries;
+};
@@ -7,20 +7,147 @@
 #include "InputManager.h"
 #include "GraphicsManager.h"
 #include "EntityManager.h"
+#include "EntityCommandBuffer.h"
 #include "Types.h"
+#include "FramePacer.h"		//for its clock
+#include "MappedFile.h"
 
 #include "spdlog/spdlog.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
 using namespace momoengine;
 
+namespace {
+	//bytecode only loads into the VM that wrote it, so the VM is part of every source hash
+#ifdef MOMO_LUAJIT
+	const char* VM = LUAJIT_VERSION;
+#else
+	const char* VM = LUA_RELEASE;
+#endif
+
+	const char CacheMagic[8] = { 'M', 'O', 'M', 'O', 'L', 'U', 'A', 'C' };	//a .luac: hash, bytecode
+	const char PackMagic[8] = { 'M', 'O', 'M', 'O', 'P', 'A', 'C', 'K' };		//a pack: VM, count, then name, path, hash, bytecode each
+
+	//FNV-1a of the VM and the source
+	std::uint64_t SourceHash(std::string_view source) {
+		std::uint64_t hash = 0xcbf29ce484222325ull;
+		auto add = [&](std::string_view text) {
+			for (char c : text) hash = (hash ^ (unsigned char)c) * 0x100000001b3ull;
+		};
+		add(VM);
+		add(source);
+		return hash;
+	}
+
+	bool ReadFile(const std::string& path, std::string& contents) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return false;
+		std::ostringstream buffer;
+		buffer << file.rdbuf();
+		contents = std::move(buffer).str();
+		return true;
+	}
+
+	//written aside and renamed into place, so a crash or another launch never sees half a file
+	bool WriteFile(const std::string& path, std::string_view contents) {
+		std::string temporary = path + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			file.write(contents.data(), contents.size());
+			if (!file) return false;
+		}
+		std::error_code error;
+		std::filesystem::rename(temporary, path, error);
+		return !error;
+	}
+
+	//integers in native byte order, like the bytecode itself; strings as a 64-bit size then the bytes
+	template <typename T>
+	void Put(std::string& out, T value) {
+		out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	void PutString(std::string& out, std::string_view text) {
+		Put<std::uint64_t>(out, text.size());
+		out.append(text);
+	}
+
+	//reads what Put() wrote; ok turns false instead of reading past the end
+	struct Reader {
+		std::string_view data;
+		bool ok = true;
+
+		template <typename T>
+		T Get() {
+			T value{};
+			if (data.size() < sizeof(T)) ok = false;
+			if (!ok) return value;
+			std::memcpy(&value, data.data(), sizeof(T));
+			data.remove_prefix(sizeof(T));
+			return value;
+		}
+
+		std::string_view GetString() {
+			std::uint64_t size = Get<std::uint64_t>();
+			if (data.size() < size) ok = false;
+			if (!ok) return {};
+			std::string_view text = data.substr(0, size);
+			data.remove_prefix(size);
+			return text;
+		}
+
+		bool Magic(const char (&magic)[8]) {
+			if (data.size() < sizeof(magic) || std::memcmp(data.data(), magic, sizeof(magic)) != 0) ok = false;
+			if (ok) data.remove_prefix(sizeof(magic));
+			return ok;
+		}
+	};
+}
+
+#ifdef MOMO_LUAJIT
+namespace {
+	//C++ components scripts can reach through LuaJIT's FFI; each declaration has to lay out exactly like Types.h
+	struct FFIComponent {
+		const char* name;
+		const char* declaration;
+		const ComponentInfo* info;
+	};
+
+	static_assert(sizeof(Position) == 2 * sizeof(float) && offsetof(Position, y) == sizeof(float));
+	static_assert(sizeof(Velocity) == 2 * sizeof(float) && offsetof(Velocity, y) == sizeof(float));
+	static_assert(sizeof(Gravity) == sizeof(float));
+	static_assert(sizeof(Health) == sizeof(float));
+	static_assert(sizeof(Camera) == 3 * sizeof(float) && offsetof(Camera, zoom) == 2 * sizeof(float));
+	static_assert(sizeof(EntityManager::Entity) == sizeof(std::uint32_t));
+
+	std::vector<FFIComponent> FFIComponents() {
+		return {
+			{ "Position", "typedef struct { float x, y; } Position;", ComponentInfo::Get<Position>() },
+			{ "Velocity", "typedef struct { float x, y; } Velocity;", ComponentInfo::Get<Velocity>() },
+			{ "Gravity", "typedef struct { float meters_per_second; } Gravity;", ComponentInfo::Get<Gravity>() },
+			{ "Health", "typedef struct { float percent; } Health;", ComponentInfo::Get<Health>() },
+			{ "Camera", "typedef struct { float x, y, zoom; } Camera;", ComponentInfo::Get<Camera>() }
+		};
+	}
+}
+#endif
+
 bool ScriptManager::Startup(Engine* eng, InputManager* inputMgr, GraphicsManager* gMgr) {
 	//store input
 	input = inputMgr;
 
 	//store engine pointer
 	engine = eng;
+	if (engine) deferred = std::make_unique<EntityCommandBuffer>(engine->GetEntityManager());
 
 	//store graphics pointer
 	graphics = gMgr;
@@ -44,10 +171,26 @@ bool ScriptManager::Startup(Engine* eng, InputManager* inputMgr, GraphicsManager
 	//quit functionality
 	lua.set_function("Quit", [&]() { if (engine) engine->Quit(); });
 
-	//LoadTexture() functionality
-	lua.set_function("LoadTexture", [&](const std::string& name, const std::string& path) {
-		if (graphics) return graphics->LoadTexture(name, path);
-		return false;
+	//LoadTexture() functionality; decodes in the background so scripts can queue many images without stalling
+	//sprites using the texture draw a placeholder until it's ready. Returns a handle for TextureState(), or nil without graphics
+	lua.set_function("LoadTexture", [&](const std::string& name, const std::string& path) -> sol::optional<GraphicsManager::TextureHandle> {
+		if (!graphics) return sol::nullopt;
+		return graphics->LoadTextureAsync(name, path);
+		});
+
+	//"loading", "ready" or "failed" (a missing or undecodable file, or a handle LoadTexture() never returned)
+	lua.set_function("TextureState", [&](GraphicsManager::TextureHandle handle) {
+		if (!graphics) return "failed";
+		switch (graphics->GetTextureState(handle)) {
+		case GraphicsManager::TextureState::Loading: return "loading";
+		case GraphicsManager::TextureState::Ready: return "ready";
+		default: return "failed";
+		}
+		});
+
+	//decodes and uploads before returning, for scripts that need to know right away; false on failure
+	lua.set_function("LoadTextureNow", [&](const std::string& name, const std::string& path) {
+		return graphics && graphics->LoadTexture(name, path);
 		});
 
 	//LoadScript() functionality
@@ -105,6 +248,13 @@ bool ScriptManager::Startup(Engine* eng, InputManager* inputMgr, GraphicsManager
 			float,
 			int,
 			int),
+		momoengine::Sprite(const std::string&, //with a layer
+			const glm::vec3&,
+			const glm::vec2&,
+			float,
+			int,
+			int,
+			int),
 		momoengine::Sprite(const std::string&) //allows just name
 		>(),
 		"image_name", &momoengine::Sprite::image_name,
@@ -112,7 +262,8 @@ bool ScriptManager::Startup(Engine* eng, InputManager* inputMgr, GraphicsManager
 		"scale", &momoengine::Sprite::scale,
 		"z", &momoengine::Sprite::z,
 		"width", &momoengine::Sprite::width,
-		"height", &momoengine::Sprite::height
+		"height", &momoengine::Sprite::height,
+		"layer", &momoengine::Sprite::layer
 	);
 
 	spdlog::info("Sprite exposed to Lua.");
@@ -124,43 +275,370 @@ bool ScriptManager::Startup(Engine* eng, InputManager* inputMgr, GraphicsManager
 	);
 	spdlog::info("Sprite Position exposed to Lua.");
 
+	//column views for UpdateAll(); indexed from 1 like Lua arrays, e.g. positions:x(i), #entities
+	auto checked = [](std::size_t index, std::size_t count) {
+		if (index < 1 || index > count) throw std::out_of_range("index " + std::to_string(index) + " is outside 1.." + std::to_string(count));
+		return index - 1;
+	};
+	sol::usertype<EntityArray> entityArrays = lua.new_usertype<EntityArray>("EntityArray",
+		sol::no_constructor,
+		sol::meta_function::length, [](const EntityArray& array) { return array.count; },
+		"get", [checked](const EntityArray& array, std::size_t i) { return array.data[checked(i, array.count)]; }
+	);
+	sol::usertype<PositionArray> positionArrays = lua.new_usertype<PositionArray>("PositionArray",
+		sol::no_constructor,
+		sol::meta_function::length, [](const PositionArray& array) { return array.count; },
+		"x", [checked](const PositionArray& array, std::size_t i) { return array.data[checked(i, array.count)].x; },
+		"y", [checked](const PositionArray& array, std::size_t i) { return array.data[checked(i, array.count)].y; },
+		"set", [checked](PositionArray& array, std::size_t i, float x, float y) {
+			Position& pos = array.data[checked(i, array.count)];
+			pos.x = x;
+			pos.y = y;
+		},
+		//x, y and set are a full call into C++ each; read() and write() move whole columns as Lua tables in one call,
+		//so the loop between them is plain table indexing: local xs, ys = positions:read() ... positions:write(xs, ys)
+		"read", [](const PositionArray& array, sol::this_state state) {
+			sol::state_view view(state);
+			sol::table xs = view.create_table((int)array.count, 0);
+			sol::table ys = view.create_table((int)array.count, 0);
+			for (std::size_t i = 0; i < array.count; ++i) {
+				xs.raw_set(i + 1, array.data[i].x);
+				ys.raw_set(i + 1, array.data[i].y);
+			}
+			return std::make_tuple(xs, ys);
+		},
+		"write", [](PositionArray& array, sol::table xs, sol::table ys) {
+			//entries missing from either table leave that coordinate as it was
+			for (std::size_t i = 0; i < array.count; ++i) {
+				array.data[i].x = xs.raw_get_or<float>(i + 1, array.data[i].x);
+				array.data[i].y = ys.raw_get_or<float>(i + 1, array.data[i].y);
+			}
+		}
+	);
+
+#ifdef MOMO_LUAJIT
+	//LuaJIT: component layouts as FFI declarations, so hot scripts index chunk memory as plain C structs, e.g.
+	//  local p = ffi.cast("Position*", positions:pointer())	-- then p[0] .. p[#positions - 1], unchecked
+	lua.open_libraries(sol::lib::ffi, sol::lib::jit);
+	std::string declarations = "typedef uint32_t Entity;\n";
+	for (const FFIComponent& component : FFIComponents()) {
+		declarations += component.declaration;
+		declarations += "\n";
+		ffiComponents[component.name] = component.info;
+	}
+	if (!DeclareFFI(declarations)) return false;
+
+	entityArrays["pointer"] = [](const EntityArray& array) {
+		return sol::lightuserdata_value(const_cast<EntityManager::Entity*>(array.data));
+	};
+	positionArrays["pointer"] = [](const PositionArray& array) {
+		return sol::lightuserdata_value(array.data);
+	};
+
+	//one entity's component, marked changed, e.g. ffi.cast("Health*", ComponentPointer(entity, "Health")).percent = 0
+	//nil if the entity doesn't have it; the pointer is only good until components are next added or removed
+	lua.set_function("ComponentPointer", [&](EntityManager::Entity entity, const std::string& name) -> sol::object {
+		auto it = ffiComponents.find(name);
+		if (it == ffiComponents.end()) {
+			spdlog::error("Component '{}' has no FFI declaration", name);
+			return sol::lua_nil;
+		}
+		void* data = engine->GetEntityManager().GetRuntimeComponent(entity, *it->second);
+		if (!data) return sol::lua_nil;
+		return sol::make_object(lua, sol::lightuserdata_value(data));
+		});
+	spdlog::info("Component layouts declared to LuaJIT's FFI.");
+#endif
+
+	//waits for Run(entity) coroutines: each one yields back to Update(), which resumes it once the wait is over
+	//Wait() rounds up to whole ticks, and every wait lasts at least until the next tick
+	lua.set_function("Wait", sol::yielding([&](double seconds) {
+		double interval = engine ? engine->GetPacer().TickInterval() : 1.0 / 60.0;
+		std::uint64_t ticks = (std::uint64_t)std::max(1.0, std::ceil(seconds / interval - 1e-6));
+		timers.Schedule(Waiting(), timers.Now() + ticks);
+		}));
+
+	lua.set_function("WaitTicks", sol::yielding([&](std::uint64_t ticks) {
+		timers.Schedule(Waiting(), timers.Now() + std::max<std::uint64_t>(ticks, 1));
+		}));
+
+	lua.set_function("WaitForEvent", sol::yielding([&](const std::string& name) {
+		std::uint64_t wakeup = Waiting();
+		coroutines[currentCoroutine].event = name;
+		eventWaiters[name].push_back(wakeup);
+		}));
+
+	lua.set_function("RaiseEvent", [&](const std::string& name) { RaiseEvent(name); });
+
+	//lets scripts check whether a stored entity handle still refers to a live entity
+	lua.set_function("IsAlive", [&](EntityManager::Entity entity) {
+		return engine->GetEntityManager().IsAlive(entity);
+		});
+
 	//GetComponent<T> and AddComponent<T> wrappers
-	lua.set_function("GetPosition", [&](int entity) -> Position& {
+	lua.set_function("GetPosition", [&](EntityManager::Entity entity) -> Position& {
 		return engine->GetEntityManager().GetComponent<Position>(entity);
 		});
 
-	lua.set_function("SetPosition", [&](int entity, float x, float y) {
+	lua.set_function("SetPosition", [&](EntityManager::Entity entity, float x, float y) {
 		Position& pos = engine->GetEntityManager().GetComponent<Position>(entity);
 		pos.x = x;
 		pos.y = y;
 		});
 
+	//component types defined from Lua, e.g. DefineComponent("Spin", { "angle", "speed" })
+	//fields are floats, start at 0 and are stored in the entity's chunks like C++ components
+	lua.set_function("DefineComponent", [&](const std::string& name, sol::table fieldTable) {
+		std::vector<std::string> fields;
+		for (std::size_t i = 1; i <= fieldTable.size(); ++i) {
+			fields.push_back(fieldTable.get<std::string>(i));
+		}
+
+		auto existing = luaComponents.find(name);
+		if (existing != luaComponents.end()) return existing->second.fields == fields;
+
+		const ComponentInfo* info = ComponentInfo::Register(name, fields.size() * sizeof(float), alignof(float));
+		if (!info) return false;
+		luaComponents[name] = { info, fields };
+#ifdef MOMO_LUAJIT
+		//the same fields in the same order as LuaField() lays them out
+		std::string declaration = "typedef struct { ";
+		for (const std::string& field : fields) declaration += "float " + field + "; ";
+		declaration += "} " + name + ";";
+		if (DeclareFFI(declaration)) ffiComponents[name] = info;
+#endif
+		return true;
+		});
+
+	//while Update() is walking the entities, adds and removes wait in a command buffer until the walk is over,
+	//so HasComponent() doesn't see them before then
+	lua.set_function("AddComponent", [&](EntityManager::Entity entity, const std::string& name) {
+		const LuaComponent* component = FindLuaComponent(name);
+		if (!component) return false;
+		EntityManager& entities = engine->GetEntityManager();
+		if (updating) {
+			if (!entities.IsAlive(entity)) return false;
+			deferred->AddRuntimeComponent(entity, *component->info);
+			return true;
+		}
+		return entities.AddRuntimeComponent(entity, *component->info) != nullptr;
+		});
+
+	lua.set_function("HasComponent", [&](EntityManager::Entity entity, const std::string& name) {
+		auto it = luaComponents.find(name);
+		return it != luaComponents.end() && engine->GetEntityManager().ReadRuntimeComponent(entity, *it->second.info) != nullptr;
+		});
+
+	lua.set_function("RemoveComponent", [&](EntityManager::Entity entity, const std::string& name) {
+		if (const LuaComponent* component = FindLuaComponent(name)) {
+			if (updating) deferred->RemoveRuntimeComponent(entity, *component->info);
+			else engine->GetEntityManager().RemoveRuntimeComponent(entity, *component->info);
+		}
+		});
+
+	lua.set_function("GetField", [&](EntityManager::Entity entity, const std::string& name, const std::string& field) -> sol::optional<float> {
+		if (float* value = LuaField(entity, name, field, false)) return *value;
+		return sol::nullopt;
+		});
+
+	lua.set_function("SetField", [&](EntityManager::Entity entity, const std::string& name, const std::string& field, float value) {
+		if (float* target = LuaField(entity, name, field, true)) *target = value;
+		});
+
 
 	return true;
 }
 
+const ScriptManager::LuaComponent* ScriptManager::FindLuaComponent(const std::string& name) const {
+	auto it = luaComponents.find(name);
+	if (it == luaComponents.end()) {
+		spdlog::error("Component '{}' was never defined with DefineComponent()", name);
+		return nullptr;
+	}
+	return &it->second;
+}
+
+#ifdef MOMO_LUAJIT
+bool ScriptManager::DeclareFFI(const std::string& declarations) {
+	sol::protected_function cdef = lua["ffi"]["cdef"];
+	sol::protected_function_result result = cdef(declarations);
+	if (!result.valid()) {
+		sol::error err = result;
+		spdlog::error("LuaJIT rejected FFI declarations: {}", err.what());
+		return false;
+	}
+	return true;
+}
+#endif
+
+float* ScriptManager::LuaField(EntityManager::Entity entity, const std::string& component, const std::string& field, bool write) {
+	const LuaComponent* type = FindLuaComponent(component);
+	if (!type) return nullptr;
+
+	auto it = std::find(type->fields.begin(), type->fields.end(), field);
+	if (it == type->fields.end()) {
+		spdlog::error("Component '{}' has no field '{}'", component, field);
+		return nullptr;
+	}
+
+	EntityManager& entities = engine->GetEntityManager();
+	void* data = write ? entities.GetRuntimeComponent(entity, *type->info) : const_cast<void*>(entities.ReadRuntimeComponent(entity, *type->info));
+	if (!data) return nullptr;
+	return static_cast<float*>(data) + (it - type->fields.begin());
+}
+
 bool ScriptManager::LoadScript(const std::string& name, const std::string& path) {
-	//load the script from the path
-	sol::load_result loaded = lua.load_file(path);
+	std::string source;
+	if (!ReadFile(path, source)) {
+		spdlog::error("Failed to load script {} from {}: can't read the file", name, path);
+		return false;
+	}
+	std::uint64_t hash = SourceHash(source);
+	std::string cachePath = path + "c";
+
+	//the .luac is only used when it was written from this very source by this VM
+	sol::protected_function chunk;
+	std::string cached;
+	if (bytecodeCache && ReadFile(cachePath, cached)) {
+		Reader reader{ cached };
+		bool current = reader.Magic(CacheMagic) && reader.Get<std::uint64_t>() == hash;
+		std::string_view bytecode = reader.GetString();
+		if (current && reader.ok) chunk = LoadBytecode(path, bytecode);
+	}
+
+	if (!chunk.valid()) {
+		chunk = Compile(name, path, source);
+		if (!chunk.valid()) return false;
+
+		if (bytecodeCache) {
+			std::string file(CacheMagic, sizeof(CacheMagic));
+			Put<std::uint64_t>(file, hash);
+			PutString(file, chunk.dump().as_string_view());
+			if (!WriteFile(cachePath, file)) spdlog::warn("Failed to write script cache {}", cachePath);
+		}
+	}
+	return Install(name, path, chunk);
+}
+
+bool ScriptManager::PackScripts(const std::string& packPath, const std::vector<std::pair<std::string, std::string>>& namesAndPaths) {
+	std::string pack(PackMagic, sizeof(PackMagic));
+	PutString(pack, VM);
+	Put<std::uint64_t>(pack, namesAndPaths.size());
+
+	for (const auto& [name, path] : namesAndPaths) {
+		std::string source;
+		if (!ReadFile(path, source)) {
+			spdlog::error("PackScripts: can't read script {} from {}", name, path);
+			return false;
+		}
+		sol::protected_function chunk = Compile(name, path, source);
+		if (!chunk.valid()) return false;
+
+		PutString(pack, name);
+		PutString(pack, path);
+		Put<std::uint64_t>(pack, SourceHash(source));
+		PutString(pack, chunk.dump().as_string_view());
+	}
+
+	if (!WriteFile(packPath, pack)) {
+		spdlog::error("PackScripts: could not write {}", packPath);
+		return false;
+	}
+	spdlog::info("Packed {} scripts into {} ({} bytes)", namesAndPaths.size(), packPath, pack.size());
+	return true;
+}
+
+bool ScriptManager::LoadScriptPack(const std::string& packPath) {
+	MappedFile file;
+	if (!file.Open(packPath)) return false;
+
+	Reader reader{ std::string_view(reinterpret_cast<const char*>(file.Data()), file.Size()) };
+	if (!reader.Magic(PackMagic)) {
+		spdlog::error("LoadScriptPack: {} is not a script pack", packPath);
+		return false;
+	}
+	std::string_view vm = reader.GetString();
+	std::uint64_t count = reader.Get<std::uint64_t>();
+	if (!reader.ok || vm != VM) {
+		spdlog::error("LoadScriptPack: {} was written by {}, not {}", packPath, vm, VM);
+		return false;
+	}
+
+	bool success = true;
+	for (std::uint64_t i = 0; i < count; ++i) {
+		std::string name(reader.GetString());
+		std::string path(reader.GetString());
+		std::uint64_t hash = reader.Get<std::uint64_t>();
+		std::string_view bytecode = reader.GetString();
+		if (!reader.ok) {
+			spdlog::error("LoadScriptPack: {} is truncated after {} scripts", packPath, i);
+			return false;
+		}
+
+		//a shipped game may leave the sources out; when one is there and has changed, it wins
+		std::string source;
+		if (ReadFile(path, source) && SourceHash(source) != hash) {
+			success = LoadScript(name, path) && success;
+			continue;
+		}
+
+		sol::protected_function chunk = LoadBytecode(path, bytecode);
+		if (chunk.valid()) success = Install(name, path, chunk) && success;
+		else success = LoadScript(name, path) && success;
+	}
+	return success;
+}
+
+sol::protected_function ScriptManager::Compile(const std::string& name, const std::string& path, const std::string& source) {
+	double start = FramePacer::Now();
+	sol::load_result loaded = lua.load(source, "@" + path, sol::load_mode::text);
+	loadTimings.compileMilliseconds += (FramePacer::Now() - start) * 1000.0;
+	++loadTimings.compiled;
+
 	if (!loaded.valid()) {
 		sol::error err = loaded;
 		spdlog::error("Failed to load script {} from {}: {}", name, path, err.what());
-		return false;
+		return sol::protected_function();
 	}
+	return loaded.get<sol::protected_function>();
+}
 
-	//create protected function
-	sol::protected_function func = loaded;
-	scripts[name] = func;
+sol::protected_function ScriptManager::LoadBytecode(const std::string& path, std::string_view bytecode) {
+	double start = FramePacer::Now();
+	sol::load_result loaded = lua.load(bytecode, "@" + path, sol::load_mode::binary);
+	loadTimings.cachedMilliseconds += (FramePacer::Now() - start) * 1000.0;
 
-	sol::protected_function_result result = func();
+	if (!loaded.valid()) {
+		sol::error err = loaded;
+		spdlog::warn("Cached bytecode for {} didn't load, falling back to the source: {}", path, err.what());
+		return sol::protected_function();
+	}
+	++loadTimings.cached;
+	return loaded.get<sol::protected_function>();
+}
+
+bool ScriptManager::Install(const std::string& name, const std::string& path, sol::protected_function chunk) {
+	//create protected function, running in the script's own environment
+	LoadedScript& script = scripts[name];
+	script.env = sol::environment(lua, sol::create, lua.globals());
+	script.chunk = std::move(chunk);
+	sol::set_environment(script.env, script.chunk);
+
+	sol::protected_function_result result = script.chunk();
 	if (!result.valid()) {
 		sol::error err = result;
 		spdlog::error("Error running script '{}' top-level: {}", name, err.what());
 	}
+	ResolveUpdate(name, script);
 	spdlog::info("Loaded script '{}' -> {}", name, path);
 	return true;
 }
 
+void ScriptManager::LogLoadTimings() const {
+	spdlog::info("Scripts: {} compiled from source in {:.2f} ms, {} loaded as bytecode in {:.2f} ms",
+		loadTimings.compiled, loadTimings.compileMilliseconds, loadTimings.cached, loadTimings.cachedMilliseconds);
+}
+
 bool ScriptManager::RunScript(const std::string& name) {
 	auto rs = scripts.find(name);
 	if (rs == scripts.end()) {
@@ -168,43 +646,241 @@ bool ScriptManager::RunScript(const std::string& name) {
 		return false;
 	}
 
-	sol::protected_function& func = rs->second;
-	sol::protected_function_result result = func();
+	LoadedScript& script = rs->second;
+	sol::protected_function_result result = script.chunk();
 	if (!result.valid()) {
 		sol::error err = result;
 		spdlog::error("Error running script '{}': {}", name, err.what());
 		return false;
 	}
+	ResolveUpdate(name, script);	//running the top level again may have redefined it
 	return true;
 }
 
+void ScriptManager::ResolveUpdate(const std::string& name, LoadedScript& script) {
+	auto resolve = [&](const char* function) {
+		sol::object found = script.env.raw_get<sol::object>(function);
+		return found.get_type() == sol::type::function ? found.as<sol::protected_function>() : sol::protected_function();
+	};
+	script.update = resolve("Update");
+	script.updateAll = resolve("UpdateAll");
+	script.run = resolve("Run");
+	if (!script.update.valid() && !script.updateAll.valid() && !script.run.valid()) {
+		spdlog::warn("Script '{}' has no Update(), UpdateAll() or Run() function", name);
+	}
+
+	batchedScripts = std::count_if(scripts.begin(), scripts.end(), [](const auto& entry) { return entry.second.updateAll.valid(); });
+	perEntityScripts = std::count_if(scripts.begin(), scripts.end(), [](const auto& entry) {
+		return entry.second.update.valid() && !entry.second.updateAll.valid();
+		});
+	script.warnedNoPosition = false;
+}
+
 void ScriptManager::Update(EntityManager& entities) {
-	//iterate over all entities using Script component
-	entities.ForEach<Script>([&](EntityManager::Entity id, Script& script) {
-		auto it = scripts.find(script.name);
-		if (it == scripts.end()) {
-			spdlog::error("Entity {} has script '{}' that is not loaded.", id, script.name);
-			return;
+	updating = true;
+	//entities sharing a script usually come one after another, so the name lookup is skipped for runs of them
+	std::string lastName;
+	LoadedScript* loaded = nullptr;
+	bool lookedUp = false;
+	auto find = [&](EntityManager::Entity id, const std::string& name) {
+		if (!lookedUp || name != lastName) {
+			auto it = scripts.find(name);
+			lastName = name;
+			lookedUp = true;
+			loaded = it != scripts.end() ? &it->second : nullptr;
+			if (!loaded) spdlog::error("Entity {} has script '{}' that is not loaded.", id, name);
 		}
+		return loaded;
+	};
+
+	//batched scripts: one call per run of rows sharing the script, with the columns passed as arrays
+	//only the rows handed to an UpdateAll count as changed, so sprites of other scripts don't all look moved
+	if (batchedScripts > 0) {
+		entities.GetView<const Script, Position>().ForEachChunkMarking([&](std::size_t count, const EntityManager::Entity* ids, auto& markChanged, const Script* script, Position* positions) {
+			for (std::size_t row = 0, end = 0; row < count; row = end) {
+				for (end = row + 1; end < count && script[end].name == script[row].name; ++end) {}
+
+				const LoadedScript* batch = find(ids[row], script[row].name);
+				if (!batch || !batch->updateAll.valid()) continue;
+
+				entityArray = { ids + row, end - row };
+				positionArray = { positions + row, end - row };
+				sol::protected_function_result result = batch->updateAll(&entityArray, &positionArray);
+				entityArray = {};
+				positionArray = {};
+				markChanged(row, end - row);
+
+				if (!result.valid()) {
+					sol::error err = result;
+					spdlog::error("Lua error in UpdateAll() for script '{}': {}", script[row].name, err.what());
+				}
+			}
+		});
+	}
+
+	//per-entity scripts, plus entities of batched scripts that UpdateAll can't reach because they have no Position:
+	//those fall back to the script's Update(entity), or are reported once if it has none
+	//every row of a chunk shares an archetype, so one lookup per chunk tells whether UpdateAll has already run there
+	if (perEntityScripts > 0 || batchedScripts > 0) {
+		const ComponentInfo& positionInfo = *ComponentInfo::Get<Position>();
+		entities.GetView<const Script>().ForEachChunk([&](std::size_t count, const EntityManager::Entity* ids, const Script* script) {
+			bool batched = entities.ReadRuntimeComponent(ids[0], positionInfo) != nullptr;
+			if (batched && perEntityScripts == 0) return;
+
+			for (std::size_t row = 0; row < count; ++row) {
+				LoadedScript* single = find(ids[row], script[row].name);
+				if (!single) continue;
+				if (single->updateAll.valid()) {
+					if (batched) continue;
+					if (!single->update.valid()) {
+						if (!single->warnedNoPosition) {
+							spdlog::warn("Script '{}' only has UpdateAll(), which never runs for entity {} and others without a Position.", script[row].name, ids[row]);
+							single->warnedNoPosition = true;
+						}
+						continue;
+					}
+				}
+				if (!single->update.valid()) continue;
+
+				//the entity is passed in rather than set as a global
+				sol::protected_function_result result = single->update(ids[row]);
+				if (!result.valid()) {
+					sol::error err = result;
+					spdlog::error("Lua error in Update() for entity {}: {}", ids[row], err.what());
+				}
+			}
+		});
+	}
 
-		//set a global entity variable for current entity
-		lua["entity"] = id;
+	//coroutines: new and changed scripts start and run to their first wait, then whatever is due this tick resumes
+	//the timers advance first, so a wait made this tick is never over before the next one
+	EntityManager::Tick since = lastScriptTick;
+	lastScriptTick = entities.MarkTick();
+	timers.Advance(wakeups);
+	entities.ForEachRemoved<Script>(since, [&](EntityManager::Entity id) {
+		StopCoroutine(id);
+		finishedCoroutines.erase(id);
+	});
+	entities.GetView<const Script>().ForEach(Changed<Script>{ since }, [&](EntityManager::Entity id, const Script& script) {
+		StartCoroutine(id, script.name);
+	});
 
-		sol::function updateFunc = lua["Update"];
-		if (updateFunc.valid()) {
-			sol::protected_function_result result = updateFunc();
+	//events raised while these run wake their waiters on the next tick
+	resuming.swap(wakeups);
+	for (std::uint64_t wakeup : resuming) Resume(wakeup);
+	resuming.clear();
 
-			if (!result.valid()) {
-				sol::error err = result;
-				spdlog::error("Lua error in Update() for entity {}: {}", id, err.what());
-			}
-		} else {
-			spdlog::error("Script '{}' has no Update() function", script.name);
+	//components scripts added or removed along the way
+	updating = false;
+	if (deferred) deferred->Flush();
+}
+
+void ScriptManager::RaiseEvent(const std::string& name) {
+	auto it = eventWaiters.find(name);
+	if (it == eventWaiters.end()) return;
+	wakeups.insert(wakeups.end(), it->second.begin(), it->second.end());
+	eventWaiters.erase(it);
+}
+
+void ScriptManager::StartCoroutine(EntityManager::Entity entity, const std::string& name) {
+	//Changed<Script> also matches a Script that was only fetched mutably; only a new script name starts Run() again
+	auto it = coroutineOf.find(entity);
+	if (it != coroutineOf.end() && coroutines[it->second].script == name) return;
+	auto finished = finishedCoroutines.find(entity);
+	if (finished != finishedCoroutines.end()) {
+		if (finished->second == name) return;
+		finishedCoroutines.erase(finished);
+	}
+	StopCoroutine(entity);
+
+	auto script = scripts.find(name);
+	if (script == scripts.end() || !script->second.run.valid()) return;
+
+	std::uint32_t index;
+	if (!freeCoroutines.empty()) {
+		index = freeCoroutines.back();
+		freeCoroutines.pop_back();
+	}
+	else {
+		index = (std::uint32_t)coroutines.size();
+		coroutines.emplace_back();
+	}
+
+	//every coroutine gets a Lua thread of its own to keep its stack on while it waits
+	Coroutine& coroutine = coroutines[index];
+	coroutine.entity = entity;
+	coroutine.script = name;
+	coroutine.thread = sol::thread::create(lua.lua_state());
+	coroutine.coroutine = sol::coroutine(coroutine.thread.state(), script->second.run);
+	coroutine.running = true;
+	coroutine.started = false;
+	coroutineOf[entity] = index;
+
+	Resume((std::uint64_t)index << 32 | coroutine.serial);
+}
+
+void ScriptManager::StopCoroutine(EntityManager::Entity entity) {
+	auto it = coroutineOf.find(entity);
+	if (it == coroutineOf.end()) return;
+
+	//the serial moves on so the wakeups still out for it are ignored, even after the slot is reused
+	Coroutine& coroutine = coroutines[it->second];
+	if (!coroutine.event.empty()) {
+		auto waiters = eventWaiters.find(coroutine.event);
+		if (waiters != eventWaiters.end()) {
+			std::uint64_t wakeup = (std::uint64_t)it->second << 32 | coroutine.serial;
+			std::erase(waiters->second, wakeup);
+			if (waiters->second.empty()) eventWaiters.erase(waiters);
 		}
-	});
+		coroutine.event.clear();
+	}
+	coroutine.coroutine = sol::coroutine();
+	coroutine.thread = sol::thread();
+	coroutine.running = false;
+	++coroutine.serial;
+	freeCoroutines.push_back(it->second);
+	coroutineOf.erase(it);
+}
+
+void ScriptManager::Resume(std::uint64_t wakeup) {
+	std::uint32_t index = (std::uint32_t)(wakeup >> 32);
+	if (index >= coroutines.size()) return;
+	Coroutine& coroutine = coroutines[index];
+	if (!coroutine.running || coroutine.serial != (std::uint32_t)wakeup) return;
+
+	currentCoroutine = index;
+	coroutine.event.clear();	//whatever it waited for is over
+	bool first = !coroutine.started;
+	coroutine.started = true;
+	sol::protected_function_result result = first ? coroutine.coroutine(coroutine.entity) : coroutine.coroutine();
+	currentCoroutine = NoCoroutine;
+
+	//yielded from one of the Wait functions, which filed its wakeup
+	if (result.status() == sol::call_status::yielded) return;
+
+	EntityManager::Entity entity = coroutines[index].entity;
+	if (!result.valid()) {
+		sol::error err = result;
+		spdlog::error("Lua error in Run() for entity {}: {}", entity, err.what());
+	}
+	finishedCoroutines[entity] = coroutines[index].script;	//Run() returned or failed, and stays that way
+	StopCoroutine(entity);
+}
+
+std::uint64_t ScriptManager::Waiting() {
+	if (currentCoroutine == NoCoroutine) throw std::runtime_error("Wait(), WaitTicks() and WaitForEvent() only work inside a script's Run()");
+	Coroutine& coroutine = coroutines[currentCoroutine];
+	++coroutine.serial;
+	return (std::uint64_t)currentCoroutine << 32 | coroutine.serial;
 }
 
 void ScriptManager::Shutdown() {
+	coroutineOf.clear();
+	finishedCoroutines.clear();
+	coroutines.clear();
+	freeCoroutines.clear();
+	eventWaiters.clear();
+	wakeups.clear();
 	scripts.clear();
 	spdlog::info("Lua scripting shutting down...");
 }
\ No newline at end of file
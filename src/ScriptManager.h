@@ -1,9 +1,17 @@
 #pragma once
+#include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include <sol/sol.hpp>
 
 #include "EntityManager.h"
+#include "EntityCommandBuffer.h"
+#include "TimerWheel.h"
+
+struct Position;
 
 namespace momoengine {
 	//to avoid circular dependencies
@@ -15,18 +23,131 @@ namespace momoengine {
 	public:
 		bool Startup(Engine* eng, InputManager* inputMgr, GraphicsManager* gMgr);	//takes a pointer to InputManager
 		void Shutdown();
+		//compiles the script, or loads its bytecode from the .luac cache next to it when that matches the source
 		bool LoadScript(const std::string& name, const std::string& path);
 		bool RunScript(const std::string& name);
 
+		//many scripts' bytecode in one file: PackScripts() compiles (name, path) pairs into it, LoadScriptPack() loads
+		//and runs them in the same order. Entries whose source has changed since are compiled from the source instead
+		//bytecode isn't checked by Lua, so only load packs and caches the game wrote itself
+		bool PackScripts(const std::string& packPath, const std::vector<std::pair<std::string, std::string>>& namesAndPaths);
+		bool LoadScriptPack(const std::string& packPath);
+		void SetBytecodeCache(bool enabled) { bytecodeCache = enabled; }	//off: always compile, never write .luac files
+
+		//time spent turning scripts into functions, not running their top level
+		struct LoadTimings {
+			std::size_t compiled = 0;		//parsed from source
+			std::size_t cached = 0;			//loaded as bytecode
+			double compileMilliseconds = 0.0;
+			double cachedMilliseconds = 0.0;
+		};
+		const LoadTimings& GetLoadTimings() const { return loadTimings; }
+		void LogLoadTimings() const;
+
+		//runs every Script entity's script: UpdateAll(entities, positions) once per run of entities sharing a script
+		//inside a chunk when the script defines it, otherwise Update(entity) once per entity
+		//UpdateAll only sees entities that also have a Position, and mustn't add or remove components; its arrays point straight into the chunks
+		//entities without a Position get the script's Update(entity) instead; a script with no Update is warned about once
+		//also resumes the Run(entity) coroutines whose wait is over; call it once per tick
+		//components scripts add or remove are applied before it returns, so it's a structural change:
+		//as a system, declare it Exclusive() so nothing else iterates the entities meanwhile
 		void Update(class EntityManager& entities);
 
+		//wakes the Run() coroutines in WaitForEvent(name) on the next Update(); scripts can call RaiseEvent(name) too
+		void RaiseEvent(const std::string& name);
+		std::size_t RunningCoroutines() const { return coroutineOf.size(); }
+
 		sol::state& GetLua() { return lua; }
 
 	private:
 		sol::state lua;
-		std::unordered_map<std::string, sol::protected_function> scripts;
+
+		//each script runs in an environment of its own, so scripts can't overwrite each other's Update()
+		//globals it doesn't define itself fall through to the shared ones (KeyIsDown, GetPosition, ...)
+		struct LoadedScript {
+			sol::environment env;
+			sol::protected_function chunk;		//the file's top level, for RunScript()
+			sol::protected_function update;		//the script's Update(entity), looked up once after the chunk runs
+			sol::protected_function updateAll;	//the script's UpdateAll(entities, positions), preferred over Update
+			sol::protected_function run;		//the script's Run(entity), run as a coroutine per entity
+			bool warnedNoPosition = false;		//reported that UpdateAll can't reach some of its entities
+		};
+		std::unordered_map<std::string, LoadedScript> scripts;
+		std::size_t batchedScripts = 0;		//scripts with an UpdateAll
+		std::size_t perEntityScripts = 0;	//scripts with an Update and no UpdateAll
+
+		//Run(entity) coroutines: started when an entity gets (or changes) its Script, then resumed only when the
+		//Wait(seconds), WaitTicks(n) or WaitForEvent(name) they yielded in is over, so waiting entities cost nothing per tick
+		//a wakeup is the coroutine's index and its serial at the time it waited; the serial moves on at every wait,
+		//so wakeups for a wait that's over, or for a coroutine that's gone, are recognised and ignored
+		struct Coroutine {
+			EntityManager::Entity entity = EntityManager::NullEntity;
+			std::string script;
+			sol::thread thread;
+			sol::coroutine coroutine;
+			std::uint32_t serial = 0;
+			bool running = false;
+			bool started = false;		//the first resume passes the entity to Run()
+			std::string event;			//what it's in WaitForEvent() for, so stopping it can take its wakeup back
+		};
+		static constexpr std::uint32_t NoCoroutine = ~0u;
+		std::vector<Coroutine> coroutines;
+		std::vector<std::uint32_t> freeCoroutines;
+		std::unordered_map<EntityManager::Entity, std::uint32_t> coroutineOf;
+		//entities whose Run() returned or failed, with that script's name; they don't start over until they get another script
+		std::unordered_map<EntityManager::Entity, std::string> finishedCoroutines;
+		std::uint32_t currentCoroutine = NoCoroutine;		//the one being resumed, for the Wait functions
+		TimerWheel timers;		//in ticks, one per Update()
+		std::unordered_map<std::string, std::vector<std::uint64_t>> eventWaiters;
+		std::vector<std::uint64_t> wakeups, resuming;	//wakeups for the next Update(); the ones it's working through
+		EntityManager::Tick lastScriptTick = 0;
+
+		void StartCoroutine(EntityManager::Entity entity, const std::string& name);
+		void StopCoroutine(EntityManager::Entity entity);
+		void Resume(std::uint64_t wakeup);	//does nothing for a wait that's over
+		std::uint64_t Waiting();	//bumps the current coroutine's serial and returns its wakeup; throws outside Run()
+
+		//column views handed to UpdateAll; emptied after each call so a script that keeps one can't reach stale rows
+		struct EntityArray {
+			const EntityManager::Entity* data = nullptr;
+			std::size_t count = 0;
+		};
+		struct PositionArray {
+			Position* data = nullptr;
+			std::size_t count = 0;
+		};
+		EntityArray entityArray;
+		PositionArray positionArray;
+
+		void ResolveUpdate(const std::string& name, LoadedScript& script);
+
+		bool bytecodeCache = true;
+		LoadTimings loadTimings;
+		sol::protected_function Compile(const std::string& name, const std::string& path, const std::string& source);
+		sol::protected_function LoadBytecode(const std::string& path, std::string_view bytecode);
+		bool Install(const std::string& name, const std::string& path, sol::protected_function chunk);	//runs the top level
 		InputManager* input = nullptr;	//to store InputManager pointer for Startup()
 		Engine* engine = nullptr;	//so that scripts can shut down the game when necessary
 		GraphicsManager* graphics = nullptr;
+
+		//component types defined from Lua with DefineComponent(): a fixed list of float fields
+		struct LuaComponent {
+			const ComponentInfo* info;
+			std::vector<std::string> fields;
+		};
+		std::unordered_map<std::string, LuaComponent> luaComponents;
+
+		const LuaComponent* FindLuaComponent(const std::string& name) const;	//logs an error when it isn't defined
+
+		//Lua's AddComponent/RemoveComponent while Update() runs scripts from inside entity loops, played back after them
+		std::unique_ptr<EntityCommandBuffer> deferred;
+		bool updating = false;
+
+#ifdef MOMO_LUAJIT
+		//every component with an FFI declaration, C++ and Lua-defined alike, for ComponentPointer()
+		std::unordered_map<std::string, const ComponentInfo*> ffiComponents;
+		bool DeclareFFI(const std::string& declarations);	//ffi.cdef, logging what LuaJIT didn't accept
+#endif
+		float* LuaField(EntityManager::Entity entity, const std::string& component, const std::string& field, bool write);
 	};
 }
@@ -0,0 +1,474 @@
+#include "Snapshot.h"
+#include "EntityManager.h"
+#include "MappedFile.h"
+#include "Types.h"
+#include "Sprite.h"
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <fstream>
+#include <unordered_set>
+
+std::uint32_t SnapshotStrings::Add(std::string_view text) {
+	auto it = lookup.find(std::string(text));
+	if (it != lookup.end()) return it->second;
+
+	std::uint32_t index = (std::uint32_t)offsets.size() - 1;
+	chars.append(text);
+	offsets.push_back((std::uint32_t)chars.size());
+	lookup.emplace(std::string(text), index);
+	return index;
+}
+
+std::string_view SnapshotStrings::Get(std::uint32_t index) const {
+	if (index >= Count()) return {};
+	if (mappedOffsets) {
+		return std::string_view(mappedChars + mappedOffsets[index], mappedOffsets[index + 1] - mappedOffsets[index]);
+	}
+	return std::string_view(chars).substr(offsets[index], offsets[index + 1] - offsets[index]);
+}
+
+namespace {
+	//fixed-size records for the engine components that hold strings
+	struct SpriteRecord {
+		std::uint32_t imageName;
+		glm::vec3 position;
+		glm::vec2 scale;
+		float z;
+		std::int32_t width;
+		std::int32_t height;
+		std::int32_t layer;
+	};
+
+	struct SpriteComponentRecord {
+		std::uint32_t image;
+		float size;
+	};
+
+	struct ScriptRecord {
+		std::uint32_t name;
+	};
+
+	void RegisterEngineComponents(SnapshotRegistry& registry) {
+		registry.Register<Position>("Position");
+		registry.Register<Velocity>("Velocity");
+		registry.Register<Gravity>("Gravity");
+		registry.Register<Health>("Health");
+
+		registry.Register<momoengine::Sprite, SpriteRecord>("Sprite",
+			[](const momoengine::Sprite& sprite, SnapshotStrings& strings) {
+				return SpriteRecord{ strings.Add(sprite.image_name), sprite.position, sprite.scale, sprite.z, sprite.width, sprite.height, sprite.layer };
+			},
+			[](const SpriteRecord& record, const SnapshotStrings& strings) {
+				return momoengine::Sprite(std::string(strings.Get(record.imageName)), record.position, record.scale, record.z, record.width, record.height, record.layer);
+			});
+
+		registry.Register<SpriteComponent, SpriteComponentRecord>("SpriteComponent",
+			[](const SpriteComponent& sprite, SnapshotStrings& strings) {
+				return SpriteComponentRecord{ strings.Add(sprite.image), sprite.size };
+			},
+			[](const SpriteComponentRecord& record, const SnapshotStrings& strings) {
+				return SpriteComponent(std::string(strings.Get(record.image)), record.size);
+			});
+
+		registry.Register<Script, ScriptRecord>("Script",
+			[](const Script& script, SnapshotStrings& strings) {
+				return ScriptRecord{ strings.Add(script.name) };
+			},
+			[](const ScriptRecord& record, const SnapshotStrings& strings) {
+				return Script(std::string(strings.Get(record.name)));
+			});
+	}
+}
+
+SnapshotRegistry& SnapshotRegistry::Get() {
+	static SnapshotRegistry registry = [] {
+		SnapshotRegistry engineTypes;
+		RegisterEngineComponents(engineTypes);
+		return engineTypes;
+	}();
+	return registry;
+}
+
+void SnapshotRegistry::Add(Entry entry) {
+	for (Entry& existing : entries) {
+		if (existing.info == entry.info || existing.name == entry.name) {
+			spdlog::warn("Snapshot layout '{}' registered twice; keeping the newer one", entry.name);
+			existing = std::move(entry);
+			return;
+		}
+	}
+	entries.push_back(std::move(entry));
+}
+
+const SnapshotRegistry::Entry* SnapshotRegistry::Find(ComponentId type) const {
+	for (const Entry& entry : entries) {
+		if (entry.info->id == type) return &entry;
+	}
+	return nullptr;
+}
+
+const SnapshotRegistry::Entry* SnapshotRegistry::Find(std::string_view name) const {
+	for (const Entry& entry : entries) {
+		if (entry.name == name) return &entry;
+	}
+	return nullptr;
+}
+
+//file layout: header, then blocks found through the header's offsets; every block starts 16-byte aligned
+//all numbers are in the writing machine's byte order, which the header records
+namespace {
+	constexpr char SnapshotMagic[8] = { 'M', 'O', 'M', 'O', 'S', 'N', 'A', 'P' };
+	constexpr std::uint32_t SnapshotVersion = 2;	//2: Sprite records carry a layer
+	constexpr std::uint32_t ByteOrderMark = 0x01020304;
+	constexpr std::size_t BlockAlign = 16;
+
+	struct SnapshotHeader {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t byteOrder;
+		std::uint32_t typeCount;
+		std::uint32_t archetypeCount;
+		std::uint32_t locationCount;	//size of the entity index table
+		std::uint32_t stringCount;
+		std::uint64_t typesOffset;		//SnapshotType[typeCount]
+		std::uint64_t archetypesOffset;		//SnapshotArchetype[archetypeCount]
+		std::uint64_t generationsOffset;	//uint32_t[locationCount], generation of every index
+		std::uint64_t stringOffsetsOffset;	//uint32_t[stringCount + 1]
+		std::uint64_t stringCharsOffset;
+		std::uint64_t fileSize;
+	};
+
+	struct SnapshotType {
+		std::uint32_t name;		//index into the string table
+		std::uint32_t recordSize;
+	};
+
+	struct SnapshotArchetype {
+		std::uint32_t typeCount;
+		std::uint32_t entityCount;
+		std::uint64_t typesOffset;		//uint32_t[typeCount], indices into the type table
+		std::uint64_t columnsOffset;	//uint64_t[typeCount], where each column's records start
+		std::uint64_t entitiesOffset;	//uint32_t[entityCount], entity handles in row order
+	};
+
+	class SnapshotWriter {
+	public:
+		//appends bytes at the next aligned position and returns their offset
+		std::uint64_t Append(const void* data, std::size_t bytes) {
+			std::uint64_t offset = Reserve(bytes);
+			if (bytes) std::memcpy(buffer.data() + offset, data, bytes);
+			return offset;
+		}
+
+		std::uint64_t Reserve(std::size_t bytes) {
+			std::size_t offset = (buffer.size() + BlockAlign - 1) / BlockAlign * BlockAlign;
+			buffer.resize(offset + bytes);
+			return offset;
+		}
+
+		std::byte* At(std::uint64_t offset) { return buffer.data() + offset; }
+		std::vector<std::byte>& Buffer() { return buffer; }
+
+	private:
+		std::vector<std::byte> buffer;
+	};
+
+	//bounds-checked view of the mapped file
+	class SnapshotReader {
+	public:
+		SnapshotReader(const std::byte* data, std::size_t size) : data(data), size(size) {}
+
+		template <typename T>
+		const T* At(std::uint64_t offset, std::uint64_t count = 1) const {
+			if (offset > size || offset % alignof(T) != 0 || count > (size - offset) / sizeof(T)) return nullptr;
+			return reinterpret_cast<const T*>(data + offset);
+		}
+
+		const std::byte* Bytes(std::uint64_t offset, std::uint64_t bytes) const { return At<std::byte>(offset, bytes); }
+
+	private:
+		const std::byte* data;
+		std::size_t size;
+	};
+}
+
+bool EntityManager::SaveSnapshot(const std::filesystem::path& path) {
+	const SnapshotRegistry& registry = SnapshotRegistry::Get();
+	SnapshotWriter writer;
+	SnapshotStrings strings;
+	writer.Reserve(sizeof(SnapshotHeader));
+
+	std::vector<const SnapshotRegistry::Entry*> types;	//file type index -> registry entry
+	std::unordered_map<ComponentId, std::uint32_t> typeIndex;
+	std::unordered_set<ComponentId> skipped;
+	std::vector<SnapshotArchetype> archetypeTable;
+
+	for (auto& archetype : archetypes) {
+		if (archetype->Size() == 0) continue;
+
+		//columns that have a snapshot layout, with their file type index
+		std::vector<int> columns;
+		std::vector<std::uint32_t> fileTypes;
+		const auto& components = archetype->Components();
+		for (std::size_t column = 0; column < components.size(); ++column) {
+			const SnapshotRegistry::Entry* entry = registry.Find(components[column]->id);
+			if (!entry) {
+				if (skipped.insert(components[column]->id).second) {
+					spdlog::warn("SaveSnapshot: {} has no snapshot layout and is left out", components[column]->name);
+				}
+				continue;
+			}
+
+			auto [it, added] = typeIndex.emplace(entry->info->id, (std::uint32_t)types.size());
+			if (added) types.push_back(entry);
+			columns.push_back((int)column);
+			fileTypes.push_back(it->second);
+		}
+
+		SnapshotArchetype record{};
+		record.typeCount = (std::uint32_t)columns.size();
+		record.entityCount = (std::uint32_t)archetype->Size();
+		record.typesOffset = writer.Append(fileTypes.data(), fileTypes.size() * sizeof(std::uint32_t));
+
+		//entity handles, one chunk at a time
+		record.entitiesOffset = writer.Reserve(archetype->Size() * sizeof(Entity));
+		std::size_t written = 0;
+		for (std::size_t c = 0; c < archetype->ChunkCount(); ++c) {
+			Chunk& chunk = archetype->GetChunk(c);
+			std::memcpy(writer.At(record.entitiesOffset) + written * sizeof(Entity), archetype->Entities(chunk), chunk.count * sizeof(Entity));
+			written += chunk.count;
+		}
+
+		//columns: raw chunk bytes for trivially copyable types, packed records for the rest
+		std::vector<std::uint64_t> columnOffsets;
+		for (std::size_t i = 0; i < columns.size(); ++i) {
+			const SnapshotRegistry::Entry& entry = *types[fileTypes[i]];
+			std::uint64_t offset = writer.Reserve(archetype->Size() * entry.recordSize);
+			columnOffsets.push_back(offset);
+
+			std::size_t row = 0;
+			for (std::size_t c = 0; c < archetype->ChunkCount(); ++c) {
+				Chunk& chunk = archetype->GetChunk(c);
+				const std::byte* source = static_cast<const std::byte*>(archetype->Column(chunk, columns[i]));
+				std::byte* target = writer.At(offset) + row * entry.recordSize;
+				if (!entry.pack) {
+					std::memcpy(target, source, chunk.count * entry.recordSize);
+				}
+				else {
+					for (std::size_t r = 0; r < chunk.count; ++r) {
+						entry.pack(source + r * entry.info->size, target + r * entry.recordSize, strings);
+					}
+				}
+				row += chunk.count;
+			}
+		}
+		record.columnsOffset = writer.Append(columnOffsets.data(), columnOffsets.size() * sizeof(std::uint64_t));
+		archetypeTable.push_back(record);
+	}
+
+	std::vector<SnapshotType> typeTable;
+	for (const SnapshotRegistry::Entry* entry : types) {
+		typeTable.push_back({ strings.Add(entry->name), entry->recordSize });
+	}
+
+	std::vector<std::uint32_t> generations;
+	generations.reserve(locations.size());
+	for (const EntityLocation& location : locations) {
+		generations.push_back(location.generation);
+	}
+
+	SnapshotHeader header{};
+	std::memcpy(header.magic, SnapshotMagic, sizeof(SnapshotMagic));
+	header.version = SnapshotVersion;
+	header.byteOrder = ByteOrderMark;
+	header.typeCount = (std::uint32_t)typeTable.size();
+	header.archetypeCount = (std::uint32_t)archetypeTable.size();
+	header.locationCount = (std::uint32_t)generations.size();
+	header.stringCount = strings.Count();
+	header.typesOffset = writer.Append(typeTable.data(), typeTable.size() * sizeof(SnapshotType));
+	header.archetypesOffset = writer.Append(archetypeTable.data(), archetypeTable.size() * sizeof(SnapshotArchetype));
+	header.generationsOffset = writer.Append(generations.data(), generations.size() * sizeof(std::uint32_t));
+	header.stringOffsetsOffset = writer.Append(strings.Offsets().data(), strings.Offsets().size() * sizeof(std::uint32_t));
+	header.stringCharsOffset = writer.Append(strings.Chars().data(), strings.Chars().size());
+	header.fileSize = writer.Buffer().size();
+	std::memcpy(writer.At(0), &header, sizeof(header));
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(writer.Buffer().data()), (std::streamsize)writer.Buffer().size());
+	if (!file) {
+		spdlog::error("SaveSnapshot: could not write {}", path.string());
+		return false;
+	}
+
+	spdlog::info("Saved snapshot {} ({} archetypes, {} bytes)", path.string(), archetypeTable.size(), writer.Buffer().size());
+	return true;
+}
+
+bool EntityManager::LoadSnapshot(const std::filesystem::path& path) {
+	if (!locations.empty()) {
+		spdlog::error("LoadSnapshot: {} can only be loaded into an EntityManager with no entities", path.string());
+		return false;
+	}
+
+	MappedFile file;
+	if (!file.Open(path)) return false;
+
+	SnapshotReader reader(file.Data(), file.Size());
+	const SnapshotHeader* header = reader.At<SnapshotHeader>(0);
+	if (!header || std::memcmp(header->magic, SnapshotMagic, sizeof(SnapshotMagic)) != 0) {
+		spdlog::error("LoadSnapshot: {} is not a snapshot", path.string());
+		return false;
+	}
+	if (header->version != SnapshotVersion || header->byteOrder != ByteOrderMark || header->fileSize != file.Size()) {
+		spdlog::error("LoadSnapshot: {} has version {} (expected {}), a different byte order, or is truncated",
+			path.string(), header->version, SnapshotVersion);
+		return false;
+	}
+
+	const SnapshotType* typeTable = reader.At<SnapshotType>(header->typesOffset, header->typeCount);
+	const SnapshotArchetype* archetypeTable = reader.At<SnapshotArchetype>(header->archetypesOffset, header->archetypeCount);
+	const std::uint32_t* generations = reader.At<std::uint32_t>(header->generationsOffset, header->locationCount);
+	const std::uint32_t* stringOffsets = reader.At<std::uint32_t>(header->stringOffsetsOffset, (std::uint64_t)header->stringCount + 1);
+	if (!typeTable || !archetypeTable || !generations || !stringOffsets || header->locationCount > IndexMask) {
+		spdlog::error("LoadSnapshot: {} is corrupt", path.string());
+		return false;
+	}
+	const char* stringChars = reinterpret_cast<const char*>(reader.Bytes(header->stringCharsOffset, stringOffsets[header->stringCount]));
+	bool sorted = stringOffsets[0] == 0;
+	for (std::uint32_t i = 0; sorted && i < header->stringCount; ++i) {
+		sorted = stringOffsets[i] <= stringOffsets[i + 1];
+	}
+	if (!stringChars || !sorted) {
+		spdlog::error("LoadSnapshot: {} has a corrupt string table", path.string());
+		return false;
+	}
+	SnapshotStrings strings(stringOffsets, header->stringCount, stringChars);
+
+	//match saved type names against the registry
+	const SnapshotRegistry& registry = SnapshotRegistry::Get();
+	std::vector<const SnapshotRegistry::Entry*> types;
+	for (std::uint32_t t = 0; t < header->typeCount; ++t) {
+		std::string_view name = strings.Get(typeTable[t].name);
+		const SnapshotRegistry::Entry* entry = registry.Find(name);
+		if (!entry || entry->recordSize != typeTable[t].recordSize) {
+			spdlog::error("LoadSnapshot: component '{}' in {} is not registered or changed size", name, path.string());
+			return false;
+		}
+		types.push_back(entry);
+	}
+
+	//check every block before touching the world, so a bad file leaves the manager empty
+	struct Block {
+		Archetype* archetype = nullptr;
+		const std::uint32_t* entities = nullptr;
+		std::vector<int> columns;
+		std::vector<const SnapshotRegistry::Entry*> entries;
+		std::vector<const std::byte*> records;
+	};
+	std::vector<Block> blocks;
+	std::vector<bool> seen(header->locationCount, false);
+
+	for (std::uint32_t a = 0; a < header->archetypeCount; ++a) {
+		const SnapshotArchetype& record = archetypeTable[a];
+		const std::uint32_t* fileTypes = reader.At<std::uint32_t>(record.typesOffset, record.typeCount);
+		const std::uint64_t* columnOffsets = reader.At<std::uint64_t>(record.columnsOffset, record.typeCount);
+		const std::uint32_t* entities = reader.At<std::uint32_t>(record.entitiesOffset, record.entityCount);
+		if (!fileTypes || !columnOffsets || !entities) {
+			spdlog::error("LoadSnapshot: {} is corrupt", path.string());
+			return false;
+		}
+
+		Block block;
+		block.entities = entities;
+		std::vector<const ComponentInfo*> infos;
+		for (std::uint32_t i = 0; i < record.typeCount; ++i) {
+			if (fileTypes[i] >= types.size()) {
+				spdlog::error("LoadSnapshot: {} is corrupt", path.string());
+				return false;
+			}
+			const SnapshotRegistry::Entry* entry = types[fileTypes[i]];
+			const std::byte* records = reader.Bytes(columnOffsets[i], (std::uint64_t)record.entityCount * entry->recordSize);
+			if (!records || std::find(infos.begin(), infos.end(), entry->info) != infos.end()) {
+				spdlog::error("LoadSnapshot: {} is corrupt", path.string());
+				return false;
+			}
+			infos.push_back(entry->info);
+			block.entries.push_back(entry);
+			block.records.push_back(records);
+		}
+
+		for (std::uint32_t e = 0; e < record.entityCount; ++e) {
+			std::uint32_t index = IndexOf(entities[e]);
+			if (entities[e] == NullEntity || index >= header->locationCount || seen[index]
+				|| GenerationOf(entities[e]) != generations[index]) {
+				spdlog::error("LoadSnapshot: {} has a bad entity handle {}", path.string(), entities[e]);
+				return false;
+			}
+			seen[index] = true;
+		}
+
+		block.archetype = FindOrCreateArchetype(std::move(infos));
+		for (const SnapshotRegistry::Entry* entry : block.entries) {
+			block.columns.push_back(block.archetype->ColumnOf(entry->info->id));
+		}
+		blocks.push_back(std::move(block));
+	}
+
+	//rebuild the entity table with the saved generations; unused indices go on the free list in order
+	locations.resize(header->locationCount);
+	for (std::uint32_t index = 0; index < header->locationCount; ++index) {
+		locations[index].generation = generations[index] & GenerationMask;
+	}
+
+	//rows are appended a chunk-sized run at a time, so each column is copied with one memcpy per chunk
+	for (std::size_t b = 0; b < blocks.size(); ++b) {
+		Block& block = blocks[b];
+		Archetype& archetype = *block.archetype;
+		std::uint32_t count = archetypeTable[b].entityCount;
+
+		for (std::uint32_t first = 0; first < count; ) {
+			ArchetypeRow start = archetype.Allocate(block.entities[first], currentTick);
+			locations[IndexOf(block.entities[first])].archetype = &archetype;
+			locations[IndexOf(block.entities[first])].slot = start;
+
+			std::uint32_t run = (std::uint32_t)std::min<std::size_t>(count - first, archetype.ChunkCapacity() - start.row);
+			for (std::uint32_t r = 1; r < run; ++r) {
+				Entity id = block.entities[first + r];
+				locations[IndexOf(id)].archetype = &archetype;
+				locations[IndexOf(id)].slot = archetype.Allocate(id, currentTick);
+			}
+
+			Chunk& chunk = archetype.GetChunk(start.chunk);
+			for (std::size_t i = 0; i < block.columns.size(); ++i) {
+				const SnapshotRegistry::Entry& entry = *block.entries[i];
+				std::byte* target = static_cast<std::byte*>(archetype.Column(chunk, block.columns[i])) + start.row * entry.info->size;
+				const std::byte* source = block.records[i] + (std::size_t)first * entry.recordSize;
+				if (!entry.unpack) {
+					std::memcpy(target, source, (std::size_t)run * entry.recordSize);
+				}
+				else {
+					for (std::uint32_t r = 0; r < run; ++r) {
+						entry.unpack(target + r * entry.info->size, source + r * entry.recordSize, strings);
+					}
+				}
+			}
+			first += run;
+		}
+	}
+
+	for (std::uint32_t index = 0; index < header->locationCount; ++index) {
+		if (locations[index].archetype) continue;
+		locations[index].nextFree = NullEntity;
+		if (freeTail != NullEntity) {
+			locations[freeTail].nextFree = index;
+		}
+		else {
+			freeHead = index;
+		}
+		freeTail = index;
+	}
+
+	spdlog::info("Loaded snapshot {} ({} archetypes, {} bytes)", path.string(), header->archetypeCount, file.Size());
+	return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "Archetype.h"
+
+//strings referenced by snapshot records, stored once each and referred to by index
+//while saving it collects strings; while loading it reads them straight out of the mapped file
+class SnapshotStrings {
+public:
+	SnapshotStrings() = default;
+	SnapshotStrings(const std::uint32_t* offsets, std::uint32_t count, const char* chars)
+		: mappedOffsets(offsets), mappedCount(count), mappedChars(chars) {}
+
+	std::uint32_t Add(std::string_view text);	//returns the index of the string, adding it if it's new
+	std::string_view Get(std::uint32_t index) const;	//empty for an out-of-range index
+
+	std::uint32_t Count() const { return mappedOffsets ? mappedCount : (std::uint32_t)offsets.size() - 1; }
+	const std::vector<std::uint32_t>& Offsets() const { return offsets; }	//count + 1 entries; string i is [offsets[i], offsets[i + 1])
+	const std::string& Chars() const { return chars; }
+
+private:
+	std::vector<std::uint32_t> offsets{ 0 };
+	std::string chars;
+	std::unordered_map<std::string, std::uint32_t> lookup;
+
+	const std::uint32_t* mappedOffsets = nullptr;
+	std::uint32_t mappedCount = 0;
+	const char* mappedChars = nullptr;
+};
+
+//stable on-disk names and record layouts for the component types that go into world snapshots
+//trivially copyable components are stored as raw bytes; anything else is packed into a fixed-size record
+//so every column in the file is still a flat array that can be copied a chunk at a time
+class SnapshotRegistry {
+public:
+	struct Entry {
+		std::string name;
+		const ComponentInfo* info;
+		std::uint32_t recordSize;
+		//both empty for trivially copyable types; unpack constructs into uninitialized component memory
+		std::function<void(const void* component, void* record, SnapshotStrings& strings)> pack;
+		std::function<void(void* component, const void* record, const SnapshotStrings& strings)> unpack;
+	};
+
+	//the engine's own component types are registered the first time this is called
+	static SnapshotRegistry& Get();
+
+	template <typename T>
+	void Register(std::string name);
+
+	//Record must be trivially copyable; strings go through the string table as indices
+	template <typename T, typename Record>
+	void Register(std::string name, Record (*pack)(const T& component, SnapshotStrings& strings),
+		T (*unpack)(const Record& record, const SnapshotStrings& strings));
+
+	const Entry* Find(ComponentId type) const;
+	const Entry* Find(std::string_view name) const;
+
+private:
+	std::vector<Entry> entries;
+
+	void Add(Entry entry);
+};
+
+template <typename T>
+void SnapshotRegistry::Register(std::string name) {
+	static_assert(std::is_trivially_copyable_v<T>, "components that aren't trivially copyable need pack/unpack functions");
+	Add({ std::move(name), ComponentInfo::Get<T>(), (std::uint32_t)sizeof(T), nullptr, nullptr });
+}
+
+template <typename T, typename Record>
+void SnapshotRegistry::Register(std::string name, Record (*pack)(const T&, SnapshotStrings&),
+	T (*unpack)(const Record&, const SnapshotStrings&)) {
+	static_assert(std::is_trivially_copyable_v<Record>, "snapshot records are copied as raw bytes");
+	Add({
+		std::move(name),
+		ComponentInfo::Get<T>(),
+		(std::uint32_t)sizeof(Record),
+		[pack](const void* component, void* record, SnapshotStrings& strings) {
+			Record packed = pack(*static_cast<const T*>(component), strings);
+			std::memcpy(record, &packed, sizeof(Record));
+		},
+		[unpack](void* component, const void* record, const SnapshotStrings& strings) {
+			Record packed;
+			std::memcpy(&packed, record, sizeof(Record));	//records in the file aren't necessarily aligned for Record
+			new (component) T(unpack(packed, strings));
+		}
+	});
+}
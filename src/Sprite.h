@@ -12,9 +12,10 @@ namespace momoengine {
 		glm::vec3 position;			//translation in the world space
 		glm::vec2 scale;			//scale factor
 
-		float z;	//depth for sorting
+		float z;	//depth for sorting; lower z draws first, behind higher z
 		int width;	//pixel width of the image
 		int height; //pixel height of the image
+		int layer = 0;	//coarse ordering above z: every sprite on a lower layer draws before any on a higher one
 
 		//copy constructor
 		Sprite(const std::string& name,
@@ -22,8 +23,9 @@ namespace momoengine {
 			const glm::vec2& scl = glm::vec2(1.0f),
 			float depth = 0.0f,
 			int w = 1,
-			int h = 1)
-			: image_name(name), position(pos), scale(scl), z(depth), width(w), height(h) {
+			int h = 1,
+			int lyr = 0)
+			: image_name(name), position(pos), scale(scl), z(depth), width(w), height(h), layer(lyr) {
 		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include "SpriteGrid.h"
+
+namespace momoengine {
+
+    void SpriteGrid::Insert(std::uint32_t item, float x, float y) {
+        if (item >= entries.size()) entries.resize(item + 1);
+        File(item, Key(CellOf(x), CellOf(y)));
+    }
+
+    bool SpriteGrid::Move(std::uint32_t item, float x, float y) {
+        CellKey cell = Key(CellOf(x), CellOf(y));
+        if (entries[item].cell == cell) return false;
+
+        Unfile(item);
+        File(item, cell);
+        return true;
+    }
+
+    void SpriteGrid::Remove(std::uint32_t item) {
+        Unfile(item);
+    }
+
+    void SpriteGrid::Renumber(std::uint32_t from, std::uint32_t to) {
+        if (to >= entries.size()) entries.resize(to + 1);
+        entries[to] = entries[from];
+        cells[entries[to].cell][entries[to].slot] = to;
+    }
+
+    SpriteGrid::CellRange SpriteGrid::RangeOf(float minX, float minY, float maxX, float maxY) const {
+        return { CellOf(minX), CellOf(minY), CellOf(maxX), CellOf(maxY) };
+    }
+
+    void SpriteGrid::File(std::uint32_t item, CellKey cell) {
+        std::vector<std::uint32_t>& items = cells[cell];
+        entries[item] = { cell, (std::uint32_t)items.size() };
+        items.push_back(item);
+    }
+
+    //swap-removes the item from its cell's list
+    void SpriteGrid::Unfile(std::uint32_t item) {
+        Entry entry = entries[item];
+        std::vector<std::uint32_t>& items = cells[entry.cell];
+        std::uint32_t last = items.back();
+        items[entry.slot] = last;
+        entries[last].slot = entry.slot;
+        items.pop_back();
+    }
+
+}
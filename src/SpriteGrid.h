@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace momoengine {
+
+    //uniform grid over world space for culling; items are dense indices (e.g. GraphicsManager instances)
+    //each item is filed under the cell holding its center, so queries must grow their rectangle by the largest item
+    class SpriteGrid {
+    public:
+        explicit SpriteGrid(float cellSize = 1.0f) : cellSize(cellSize) {}
+
+        //inclusive range of cell coordinates
+        struct CellRange {
+            int minX = 0, minY = 0, maxX = -1, maxY = -1;
+            bool operator==(const CellRange&) const = default;
+        };
+
+        void Insert(std::uint32_t item, float x, float y);
+        bool Move(std::uint32_t item, float x, float y);    //true if the item changed cells
+        void Remove(std::uint32_t item);
+        void Renumber(std::uint32_t from, std::uint32_t to);    //item `from` is now called `to`, e.g. after a swap-remove
+
+        CellRange RangeOf(float minX, float minY, float maxX, float maxY) const;
+
+        //calls func(item) for every item filed in a cell of the range
+        template <typename Func>
+        void ForEachInRange(const CellRange& range, Func func) const;
+
+    private:
+        using CellKey = std::uint64_t;
+        struct Entry {
+            CellKey cell;
+            std::uint32_t slot;     //position inside the cell's list
+        };
+
+        float cellSize;
+        std::unordered_map<CellKey, std::vector<std::uint32_t>> cells;  //emptied cells are kept so refilling them doesn't allocate
+        std::vector<Entry> entries;     //item -> where it's filed
+
+        //clamped inside int, so extreme zooms or coordinates can't overflow the conversion;
+        //NaN lands in cell 0
+        static constexpr float CellLimit = float(1 << 30);
+        int CellOf(float coordinate) const {
+            float cell = std::floor(coordinate / cellSize);
+            if (std::isnan(cell)) return 0;
+            return (int)std::clamp(cell, -CellLimit, CellLimit);
+        }
+        static CellKey Key(int x, int y) { return CellKey(std::uint32_t(x)) << 32 | std::uint32_t(y); }
+        static int KeyX(CellKey key) { return (int)std::uint32_t(key >> 32); }
+        static int KeyY(CellKey key) { return (int)std::uint32_t(key); }
+        void File(std::uint32_t item, CellKey cell);
+        void Unfile(std::uint32_t item);
+    };
+
+    template <typename Func>
+    void SpriteGrid::ForEachInRange(const CellRange& range, Func func) const {
+        if (range.maxX < range.minX || range.maxY < range.minY) return;
+
+        //zoomed far out, the range can hold far more cells than exist; walk the existing ones instead
+        std::uint64_t rangeCells = std::uint64_t(std::int64_t(range.maxX) - range.minX + 1) * std::uint64_t(std::int64_t(range.maxY) - range.minY + 1);
+        if (rangeCells > cells.size()) {
+            for (const auto& [key, items] : cells) {
+                int x = KeyX(key), y = KeyY(key);
+                if (x < range.minX || x > range.maxX || y < range.minY || y > range.maxY) continue;
+                for (std::uint32_t item : items) func(item);
+            }
+            return;
+        }
+
+        for (int y = range.minY; y <= range.maxY; ++y) {
+            for (int x = range.minX; x <= range.maxX; ++x) {
+                auto it = cells.find(Key(x, y));
+                if (it == cells.end()) continue;
+                for (std::uint32_t item : it->second) func(item);
+            }
+        }
+    }
+
+}
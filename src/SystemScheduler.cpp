@@ -0,0 +1,123 @@
+#include "SystemScheduler.h"
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace momoengine {
+
+    namespace {
+        bool Overlaps(const std::vector<ComponentId>& a, const std::vector<ComponentId>& b) {
+            for (ComponentId type : a) {
+                if (std::find(b.begin(), b.end(), type) != b.end()) return true;
+            }
+            return false;
+        }
+    }
+
+    bool SystemScheduler::System::ConflictsWith(const System& other) const {
+        if (exclusive || other.exclusive) return true;
+        return Overlaps(writes, other.writes) || Overlaps(writes, other.reads) || Overlaps(reads, other.writes);
+    }
+
+    SystemScheduler::System& SystemScheduler::Add(std::string name, SystemFunc func) {
+        systems.push_back(std::unique_ptr<System>(new System(std::move(name), std::move(func), *this)));
+        graphDirty = true;
+        return *systems.back();
+    }
+
+    //each system waits for every earlier system it conflicts with
+    void SystemScheduler::BuildGraph() {
+        timings.clear();
+        for (auto& system : systems) {
+            system->dependents.clear();
+            system->dependencyCount = 0;
+            system->task = [this, s = system.get()](std::size_t, std::size_t) { Execute(*s); };
+            timings.push_back({ system->name, 0.0, system->mainThread });
+        }
+
+        for (std::size_t later = 0; later < systems.size(); ++later) {
+            for (std::size_t earlier = 0; earlier < later; ++earlier) {
+                if (systems[earlier]->ConflictsWith(*systems[later])) {
+                    systems[earlier]->dependents.push_back(systems[later].get());
+                    ++systems[later]->dependencyCount;
+                }
+            }
+        }
+        graphDirty = false;
+    }
+
+    void SystemScheduler::Run(EntityManager& entityManager, JobSystem& jobSystem) {
+        if (systems.empty()) return;
+        if (graphDirty) BuildGraph();
+
+        auto start = std::chrono::steady_clock::now();
+        entities = &entityManager;
+        jobs = &jobSystem;
+
+        systemsLeft.store(systems.size());
+        for (auto& system : systems) {
+            system->pending.store(system->dependencyCount, std::memory_order_relaxed);
+        }
+        for (auto& system : systems) {
+            if (system->dependencyCount == 0) MakeReady(*system);
+        }
+
+        //run main-thread systems as they become ready and help the workers in between
+        while (systemsLeft.load(std::memory_order_acquire) > 0) {
+            System* next = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mainThreadMutex);
+                if (!mainThreadReady.empty()) {
+                    next = mainThreadReady.back();
+                    mainThreadReady.pop_back();
+                }
+            }
+
+            if (next) {
+                Execute(*next);
+            }
+            else if (!jobs->RunPending()) {
+                std::this_thread::yield();
+            }
+        }
+        jobs->Wait(tasksInFlight);  //the last tasks may still be returning
+
+        for (std::size_t i = 0; i < systems.size(); ++i) {
+            timings[i].milliseconds = systems[i]->milliseconds;
+        }
+        frameMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void SystemScheduler::MakeReady(System& system) {
+        if (system.mainThread) {
+            std::lock_guard<std::mutex> lock(mainThreadMutex);
+            mainThreadReady.push_back(&system);
+        }
+        else {
+            jobs->Dispatch(1, 1, system.task, tasksInFlight);
+        }
+    }
+
+    void SystemScheduler::Execute(System& system) {
+        auto start = std::chrono::steady_clock::now();
+        system.func(*entities);
+        system.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        for (System* dependent : system.dependents) {
+            if (dependent->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                MakeReady(*dependent);
+            }
+        }
+        systemsLeft.fetch_sub(1, std::memory_order_release);
+    }
+
+    void SystemScheduler::LogTimings() const {
+        spdlog::debug("Systems took {:.3f} ms this tick:", frameMilliseconds);
+        for (const Timing& timing : timings) {
+            spdlog::debug("  {:<24} {:.3f} ms{}", timing.name, timing.milliseconds, timing.mainThread ? " (main thread)" : "");
+        }
+    }
+
+}
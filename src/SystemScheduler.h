@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "EntityManager.h"
+#include "JobSystem.h"
+
+namespace momoengine {
+
+    //runs every registered system once per tick
+    //systems declare the components they read and write; two systems conflict when one writes something the
+    //other touches, conflicting systems run in registration order and everything else runs in parallel
+    class SystemScheduler {
+    public:
+        using SystemFunc = std::function<void(EntityManager& entities)>;
+
+        class System {
+        public:
+            //declares component access; returns *this so calls can be chained
+            //access that isn't declared isn't checked, so a system must list everything it iterates or fetches
+            template <typename... Components>
+            System& Reads() {
+                (reads.push_back(ComponentIdOf<Components>()), ...);
+                scheduler.graphDirty = true;
+                return *this;
+            }
+
+            template <typename... Components>
+            System& Writes() {
+                (writes.push_back(ComponentIdOf<Components>()), ...);
+                scheduler.graphDirty = true;
+                return *this;
+            }
+
+            //runs on the thread calling Run(); needed for anything using GLFW, WebGPU or Lua
+            System& OnMainThread() { mainThread = true; return *this; }
+
+            //runs on the main thread with no other system running; needed for structural changes
+            System& Exclusive() { exclusive = true; mainThread = true; scheduler.graphDirty = true; return *this; }
+
+            const std::string& Name() const { return name; }
+
+        private:
+            friend class SystemScheduler;
+
+            System(std::string name, SystemFunc func, SystemScheduler& scheduler)
+                : name(std::move(name)), func(std::move(func)), scheduler(scheduler) {}
+
+            std::string name;
+            SystemFunc func;
+            SystemScheduler& scheduler;
+            std::vector<ComponentId> reads;
+            std::vector<ComponentId> writes;
+            bool mainThread = false;
+            bool exclusive = false;
+
+            //dependency graph, rebuilt when systems or their access change
+            std::vector<System*> dependents;    //systems that have to wait for this one
+            std::uint32_t dependencyCount = 0;
+            std::atomic<std::uint32_t> pending{ 0 };    //dependencies not finished yet this tick
+            JobSystem::RangeFunc task;  //what a worker thread runs
+            double milliseconds = 0.0;
+
+            bool ConflictsWith(const System& other) const;
+        };
+
+        struct Timing {
+            std::string name;
+            double milliseconds;    //time spent inside the system this tick
+            bool mainThread;
+        };
+
+        //the reference stays valid for the scheduler's lifetime
+        System& Add(std::string name, SystemFunc func);
+
+        //runs every system once and blocks until all of them are done
+        void Run(EntityManager& entities, JobSystem& jobs);
+
+        //per-system timings from the last Run(), in registration order
+        const std::vector<Timing>& Timings() const { return timings; }
+        double FrameMilliseconds() const { return frameMilliseconds; }  //wall time of the last Run()
+
+        void LogTimings() const;
+
+    private:
+        std::vector<std::unique_ptr<System>> systems;
+        bool graphDirty = false;
+
+        //state of the Run() in progress
+        EntityManager* entities = nullptr;
+        JobSystem* jobs = nullptr;
+        std::atomic<std::size_t> systemsLeft{ 0 };
+        std::atomic<std::size_t> tasksInFlight{ 0 };
+        std::mutex mainThreadMutex;
+        std::vector<System*> mainThreadReady;   //main-thread systems whose dependencies are done
+
+        std::vector<Timing> timings;
+        double frameMilliseconds = 0.0;
+
+        void BuildGraph();
+        void MakeReady(System& system);
+        void Execute(System& system);
+    };
+
+}
@@ -0,0 +1,40 @@
+#include "TimerWheel.h"
+
+#include <algorithm>
+
+namespace momoengine {
+
+    namespace {
+        //std heaps keep the largest first
+        constexpr auto LaterFirst = [](const auto& a, const auto& b) { return a.tick > b.tick; };
+    }
+
+    void TimerWheel::Schedule(std::uint64_t payload, std::uint64_t tick) {
+        tick = std::max(tick, now + 1);
+        ++pending;
+        if (tick - now < Slots) {
+            slots[tick % Slots].push_back({ payload, tick });
+            return;
+        }
+        later.push_back({ payload, tick });
+        std::push_heap(later.begin(), later.end(), LaterFirst);
+    }
+
+    void TimerWheel::Advance(std::vector<std::uint64_t>& due) {
+        ++now;
+
+        //the last tick's slot is free again, so one more tick's worth of far timers fits
+        while (!later.empty() && later.front().tick - now < Slots) {
+            std::pop_heap(later.begin(), later.end(), LaterFirst);
+            slots[later.back().tick % Slots].push_back(later.back());
+            later.pop_back();
+        }
+
+        //every timer in this slot is due now: none is placed Slots or more ticks ahead
+        std::vector<Timer>& slot = slots[now % Slots];
+        for (const Timer& timer : slot) due.push_back(timer.payload);
+        pending -= slot.size();
+        slot.clear();
+    }
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace momoengine {
+
+    //wakes timers by tick without looking at the ones that aren't due
+    //timers due within the next Slots ticks sit in the slot for their tick, so advancing takes just that slot;
+    //later ones wait in a heap and move into the wheel as their tick comes within range
+    //a timer can't be cancelled; whoever scheduled it ignores the wakeup instead (e.g. by checking a serial in the payload)
+    class TimerWheel {
+    public:
+        static constexpr std::size_t Slots = 256;
+
+        std::uint64_t Now() const { return now; }   //the tick last advanced to
+        void Schedule(std::uint64_t payload, std::uint64_t tick);   //ticks at or before Now() fire on the next Advance()
+        void Advance(std::vector<std::uint64_t>& due);  //moves to the next tick and appends the payloads due at it
+        std::size_t Pending() const { return pending; }
+
+    private:
+        struct Timer {
+            std::uint64_t payload;
+            std::uint64_t tick;
+        };
+
+        std::uint64_t now = 0;
+        std::size_t pending = 0;
+        std::array<std::vector<Timer>, Slots> slots;
+        std::vector<Timer> later;   //min-heap on tick, for timers Slots or more ticks away
+    };
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <utility>
+
+namespace momoengine {
+
+    //hands the newest of a stream of values from one producer thread to one consumer thread
+    //the producer fills Back() and publishes it; the consumer swaps the newest published one into Front()
+    //with three buffers neither side waits for the other, and the producer skips ahead if the consumer is slow
+    template <typename T>
+    class TripleBuffer {
+    public:
+        T& Back() { return buffers[back]; }     //producer side: the buffer to fill next
+        void Publish();
+
+        const T& Front() const { return buffers[front]; }   //consumer side: the buffer last acquired
+        bool Acquire();     //false if nothing was published since the last call, leaving Front() as it was
+
+    private:
+        std::array<T, 3> buffers;
+        std::size_t back = 0, middle = 1, front = 2;    //middle is the newest published buffer
+        bool fresh = false;     //middle hasn't been acquired yet
+        std::mutex mutex;       //guards the swaps only, never the buffers' contents
+    };
+
+    template <typename T>
+    void TripleBuffer<T>::Publish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(back, middle);
+        fresh = true;
+    }
+
+    template <typename T>
+    bool TripleBuffer<T>::Acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!fresh) return false;
+        std::swap(front, middle);
+        fresh = false;
+        return true;
+    }
+
+}
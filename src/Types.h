@@ -30,6 +30,14 @@ struct Health {
 	Health(float p = 100.0f) : percent(p) {}	//constructor
 };
 
+//what Draw() looks at: world position of the view's center, and how many times bigger things appear
+//without one the view sits at the origin with zoom 1
+struct Camera {
+	float x, y;
+	float zoom;
+	Camera(float x = 0.0f, float y = 0.0f, float zoom = 1.0f) : x(x), y(y), zoom(zoom) {}	//constructor
+};
+
 struct Script {
 	std::string name;
 	Script(const std::string& n = "") : name(n) {}		//constructor